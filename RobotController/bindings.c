@@ -0,0 +1,741 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __WIN32__
+    #include <windows.h>
+#endif
+#include <unistd.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+#include "bindings.h"
+
+// Bindings with a joystick plugged in, by instance ID with linear probing
+static robotBinding *instanceTable[INSTANCE_SLOTS];
+
+static int nextSlot(int slot) {
+    return (slot + 1) & (INSTANCE_SLOTS - 1);
+}
+
+static void addInstance(robotBinding *binding) {
+    int slot = binding->instance & (INSTANCE_SLOTS - 1);
+    while (instanceTable[slot] != NULL) {
+        slot = nextSlot(slot);
+    }
+    instanceTable[slot] = binding;
+}
+
+static void removeInstance(robotBinding *binding) {
+    int slot = binding->instance & (INSTANCE_SLOTS - 1);
+    while (instanceTable[slot] != NULL && instanceTable[slot] != binding) {
+        slot = nextSlot(slot);
+    }
+    if (instanceTable[slot] == NULL) {
+        return;
+    }
+    instanceTable[slot] = NULL;
+    // put back anything after it that probed past, so that lookups don't stop at the gap
+    for (slot = nextSlot(slot); instanceTable[slot] != NULL; slot = nextSlot(slot)) {
+        robotBinding *moved = instanceTable[slot];
+        instanceTable[slot] = NULL;
+        addInstance(moved);
+    }
+}
+
+robotBinding *findBinding(SDL_JoystickID instance) {
+    for (int slot = instance & (INSTANCE_SLOTS - 1); instanceTable[slot] != NULL; slot = nextSlot(slot)) {
+        if (instanceTable[slot]->instance == instance) {
+            return instanceTable[slot];
+        }
+    }
+    return NULL;
+}
+
+
+// A binding's own settings are in sections named after it, e.g. [red:trim],
+// anything not there comes from the shared section, e.g. [trim]
+static void bindingSection(const robotBinding *binding, const char *section, char *own, int length) {
+    if (binding->name[0] != '\0') {
+        snprintf(own, length, "%s:%s", binding->name, section);
+    }
+    else {
+        snprintf(own, length, "%s", section);
+    }
+}
+
+int getBindingInt(configFile config, const robotBinding *binding, const char *section, const char *key, int def) {
+    char own[STRING_BUFFER_LENGTH*2];
+    bindingSection(binding, section, own, sizeof(own));
+#ifdef  __linux__
+    return getIntFromConfig(config, own, key, getIntFromConfig(config, section, key, def));
+#elif __WIN32__
+    return GetPrivateProfileInt(own, key, GetPrivateProfileInt(section, key, def, config), config);
+#endif
+}
+
+void getBindingString(configFile config, const robotBinding *binding, const char *section, const char *key, const char *def, char *value, int length) {
+    char own[STRING_BUFFER_LENGTH*2];
+    bindingSection(binding, section, own, sizeof(own));
+#ifdef  __linux__
+    char *temp = getStringFromConfig(config, own, key, getStringFromConfig(config, section, key, (char *)def));
+    snprintf(value, length, "%s", temp);
+#elif __WIN32__
+    char shared[BUTTON_VALUE_LENGTH];
+    GetPrivateProfileString(section, key, def, shared, sizeof(shared), config);
+    GetPrivateProfileString(own, key, shared, value, length, config);
+#endif
+}
+
+float getBindingFloat(configFile config, const robotBinding *binding, const char *section, const char *key, float def) {
+#ifdef  __linux__
+    char own[STRING_BUFFER_LENGTH*2];
+    bindingSection(binding, section, own, sizeof(own));
+    return getFloatFromConfig(config, own, key, getFloatFromConfig(config, section, key, def));
+#elif __WIN32__
+    char value[STRING_BUFFER_LENGTH];
+    getBindingString(config, binding, section, key, "", value, sizeof(value));
+    return strlen(value) > 0 ? atof(value) : def;
+#endif
+}
+
+// printTime() with the binding's name, if it has one
+void printBinding(const robotBinding *binding) {
+    printTime();
+    if (binding->name[0] != '\0') {
+        printf("%s: ", binding->name);
+    }
+}
+
+
+// Read everything about a binding's robot and open its connection, returns 0 or an exit code
+int loadBinding(robotBinding *binding, configFile config) {
+    int i, j;
+    char keyname[STRING_BUFFER_LENGTH], keyname2[STRING_BUFFER_LENGTH];
+    UDPremote *remote = &binding->remote;
+    robotState *robotstate = &binding->robotstate;
+    inputPipeline *pipeline = &binding->pipeline;
+
+    // Networking...
+    char remote_host[STRING_BUFFER_LENGTH*4];
+    getBindingString(config, binding, "network", "remote_host", REMOTE_HOST, remote_host, sizeof(remote_host));
+    int server_port = getBindingInt(config, binding, "network", "server_port", SERVER_PORT);
+    binding->control_priority = getBindingInt(config, binding, "network", "control_priority", 0);
+    if (server_port < 0 || server_port > 65534) {
+        server_port = SERVER_PORT;
+    }
+    if (binding->control_priority < 0) {
+        binding->control_priority = 0;
+    }
+    printBinding(binding);
+    printf("Sending to %s:%i, control priority %i\n", remote_host, server_port, binding->control_priority);
+
+    remote->nextpacket = 0;
+    remote->lastPacketTime = SDL_GetTicks();
+    SDLNet_ResolveHost(&remote->remoteAddr, remote_host, server_port);
+
+    // heartbeats and redundancy adapt to the link between these bounds
+    int heartbeat_min = getBindingInt(config, binding, "network", "heartbeat_min", HEARTBEAT_TIMEOUT/5);
+    int heartbeat_max = getBindingInt(config, binding, "network", "heartbeat_max", HEARTBEAT_TIMEOUT);
+    int max_redundancy = getBindingInt(config, binding, "network", "max_redundancy", 3);
+    remote->emulatedLoss = getBindingFloat(config, binding, "network", "emulated_loss", 0);
+    if (heartbeat_max <= 0 || heartbeat_max > CONTROLLER_TIMEOUT/3) heartbeat_max = HEARTBEAT_TIMEOUT;
+    if (heartbeat_min <= 0 || heartbeat_min > heartbeat_max) heartbeat_min = heartbeat_max;
+    if (max_redundancy < 0) max_redundancy = 0;
+    initLink(&remote->link, heartbeat_min, heartbeat_max, max_redundancy);
+    printBinding(binding);
+    printf("Heartbeat every %i-%i ms, up to %i redundant setpoints\n", heartbeat_min, heartbeat_max, max_redundancy);
+    if (remote->emulatedLoss > 0) {
+        printBinding(binding);
+        printf("Emulating %.1f%% packet loss!\n", remote->emulatedLoss * 100);
+    }
+
+#ifdef  __linux__
+    // optionally bypass SDL_net for batched sends and priority marking
+    char backend[STRING_BUFFER_LENGTH];
+    getBindingString(config, binding, "network", "backend", "sdl", backend, sizeof(backend));
+    if (strcmp(backend, "native") == 0) {
+        int dscp = getBindingInt(config, binding, "network", "dscp", DEFAULT_DSCP);
+        int priority = getBindingInt(config, binding, "network", "priority", DEFAULT_SO_PRIORITY);
+        if (!nativeOpen(&remote->native, &remote->remoteAddr, dscp, priority)) {
+            return 4;
+        }
+        remote->useNative = 1;
+        printBinding(binding);
+        printf("Using native sockets, DSCP %i, priority %i\n", dscp, priority);
+    }
+#endif
+
+    remote->udpsocket = SDLNet_UDP_Open(0);
+    if (!remote->udpsocket) {
+        fprintf(stderr, "SDLNet_UDP_Open: %s\n", SDLNet_GetError());
+        return 4;
+    }
+    remote->packet = SDLNet_AllocPacket(PACKET_LENGTH);
+    if (!remote->packet) {
+        fprintf(stderr, "SDLNet_AllocPacket: %s\n", SDLNet_GetError());
+        return 5;
+    }
+
+
+    // read in robot configurations
+    int numMotors = getBindingInt(config, binding, "robot", "num_motors", 2);
+    binding->idle_timeout = getBindingInt(config, binding, "robot", "idle_timeout", 120)*1000;
+    if (numMotors < 0 || numMotors > MAX_NUM_MOTORS) {
+        numMotors = 2;
+    }
+    binding->numMotors = numMotors;
+    printBinding(binding);
+    printf("Using %i motors, becoming idle after %li s\n", numMotors, binding->idle_timeout/1000);
+
+    robotstate->speed = 1; // fast
+    robotstate->invert = 0;
+    robotstate->enabled = 0;
+    robotstate->numMotors = numMotors;
+    for (i = 0; i < MAX_NUM_MOTORS; i++) {
+        robotstate->axis[i] = 0;
+    }
+    robotstate->macros = binding->macros;
+    robotstate->pipeline = pipeline;
+    robotstate->joystick = NULL; // until attachJoystick()
+    robotstate->recording = NULL;
+
+
+    // setup trim
+    for (i = 0; i < numMotors; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_min", motornames[i]);
+        snprintf(keyname2, STRING_BUFFER_LENGTH, "%s_max", motornames[i]);
+        binding->trim_min[i] = getBindingInt(config, binding, "trim", keyname, 0);
+        binding->trim_max[i] = getBindingInt(config, binding, "trim", keyname2, MYPWMRANGE);
+        if (binding->trim_min[i] < 0) binding->trim_min[i] = 0;
+        if (binding->trim_max[i] > MYPWMRANGE) binding->trim_max[i] = MYPWMRANGE;
+    }
+
+    printBinding(binding);
+    printf("Using ");
+    for (i = 0; i < numMotors; i++) {
+        if (i > 0) {
+            printf(", ");
+        }
+        printf("%s_min = %i, %s_max = %i", motornames[i], binding->trim_min[i], motornames[i], binding->trim_max[i]);
+    }
+    printf("\n");
+
+
+    // read in motor directions
+    for (i = 0; i < numMotors; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_dir", motornames[i]);
+        binding->axis_dir[i] = getBindingInt(config, binding, "dir", keyname, 1);
+        if (binding->axis_dir[i] != -1 && binding->axis_dir[i] != 1) binding->axis_dir[i] = 1;
+    }
+
+    printBinding(binding);
+    printf("Using dir config ");
+    for (i = 0; i < numMotors; i++) {
+        if (i > 0) {
+            printf(", ");
+        }
+        printf("%s_dir=%i", motornames[i], binding->axis_dir[i]);
+    }
+    printf("\n");
+
+
+    // read in axis mapping, the joystick is opened afterwards and could be
+    // swapped for another when it's plugged in again, so allow for any number of axes
+    int numAxes = MAX_NUM_AXES;
+    int axismap[MAX_NUM_MOTORS];
+    for (i = 0; i < numMotors; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_axis", motornames[i]);
+        axismap[i] = getBindingInt(config, binding, "axis", keyname, -1);
+        if (axismap[i] < 0 || axismap[i] >= numAxes) axismap[i] = -1;
+    }
+
+    printBinding(binding);
+    printf("Using axis mapping ");
+    for (i = 0; i < numMotors; i++) {
+        if (i > 0) {
+            printf(", ");
+        }
+        printf("%s_axis=%i", motornames[i], axismap[i]);
+    }
+    printf("\n");
+
+
+    // set up the input pipeline, by default each motor follows one axis
+    initPipeline(pipeline, numAxes, numMotors);
+    for (i = 0; i < numMotors; i++) {
+        if (axismap[i] != -1) {
+            setMix(pipeline, i, axismap[i], 1);
+        }
+    }
+
+    // a mix overrides the axis mapping, e.g. for arcade drive
+    // left_mix=-1,1 and right_mix=1,1 with the stick's x axis as 0 and y axis as 1
+    char mixstring[STRING_BUFFER_LENGTH*4];
+    float weights[MAX_NUM_AXES];
+    for (i = 0; i < numMotors; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_mix", motornames[i]);
+        getBindingString(config, binding, "mix", keyname, "", mixstring, sizeof(mixstring));
+        int count = parseFloatList(mixstring, weights, numAxes);
+        if (count > 0) {
+            for (j = 0; j < numAxes; j++) {
+                setMix(pipeline, i, j, j < count ? weights[j] : 0);
+            }
+            printBinding(binding);
+            printf("Using %s_mix=%s\n", motornames[i], mixstring);
+        }
+
+        // which motor this one drives when inverted
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_invert", motornames[i]);
+        getBindingString(config, binding, "mix", keyname, "", mixstring, sizeof(mixstring));
+        for (j = 0; j < numMotors; j++) {
+            if (strcmp(mixstring, motornames[j]) == 0) {
+                pipeline->invertmap[i] = j;
+            }
+        }
+    }
+    // every motor has to be driven by exactly one other when inverted
+    int inverted = 0;
+    for (i = 0; i < numMotors; i++) {
+        inverted |= 1 << pipeline->invertmap[i];
+    }
+    if (inverted != (1 << numMotors) - 1) {
+        fprintf(stderr, "[mix] *_invert has to swap motors around, not send two to the same one\n");
+        return 6;
+    }
+
+    // deadzone and expo for each axis, speeds are in full range per second
+    for (i = 0; i < numAxes; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "axis%i_deadzone", i);
+        snprintf(keyname2, STRING_BUFFER_LENGTH, "axis%i_expo", i);
+        int deadzone = getBindingInt(config, binding, "shaping", keyname, DEADZONE);
+        float expo = getBindingFloat(config, binding, "shaping", keyname2, 0);
+        if (deadzone < 0 || deadzone >= JOYSTICK_MAX) deadzone = DEADZONE;
+        if (expo < 0 || expo > 1) expo = 0;
+        if (deadzone != DEADZONE || expo != 0) {
+            buildAxisCurve(pipeline, i, deadzone, expo);
+            printBinding(binding);
+            printf("Using axis%i_deadzone=%i, axis%i_expo=%f\n", i, deadzone, i, expo);
+        }
+    }
+    for (i = 0; i < numMotors; i++) {
+        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_slew", motornames[i]);
+        float slew = getBindingFloat(config, binding, "shaping", keyname, 0);
+        if (slew > 0) {
+            pipeline->slew[i] = slew / 1000;
+            printBinding(binding);
+            printf("Using %s_slew=%f\n", motornames[i], slew);
+        }
+    }
+
+
+    // for each button, read in its macro or set its type appropriately
+    // a (0), b (1), x (2), y (3), lb (4), rb (5), view (6), menu (7), xbox (8), ls (9), rs (10), up (11), down (12), left (13), right (14)
+    for (i = 0; i < NUM_BUTTONS; i++) {
+        buttonDefinition *button = &binding->buttons[i];
+        binding->allbuttons[i] = button;
+        button->value = binding->buttonvalues[i];
+        getBindingString(config, binding, "buttons", buttonnames[i], "", button->value, BUTTON_VALUE_LENGTH);
+        binding->macros[i].length = -1;
+        binding->macros[i].running = 0;
+        button->macro = &binding->macros[i];
+
+        // start by handling special cases
+        if (strcmp(button->value, "fast") == 0) { //strcmp returns 0 when the strings match
+            button->type = FAST;
+        }
+        else if (strcmp(button->value, "slow") == 0) {
+            button->type = SLOW;
+        }
+        else if (strcmp(button->value, "invertoff") == 0) {
+            button->type = INVERTOFF;
+        }
+        else if (strcmp(button->value, "inverton") == 0) {
+            button->type = INVERTON;
+        }
+        else if (strcmp(button->value, "enable") == 0) {
+            button->type = ENABLE;
+        }
+        else if (strcmp(button->value, "stop") == 0) {
+            button->type = STOP;
+        }
+        else if (strcmp(button->value, "exit") == 0) {
+            button->type = EXIT;
+        }
+        else if (strcmp(button->value, "record") == 0) {
+            button->type = RECORD;
+        }
+        else if (strlen(button->value) == 0) { // nothing is programmed
+            button->type = NONE;
+        }
+        else { // read in macro
+            if (access(button->value, F_OK) != 0) { // the macro file does not exist!
+                fprintf(stderr, "file %s doesn't exist, assuming no macro\n", button->value);
+                button->value[0] = '\0';
+                button->type = NONE;
+            }
+            else {
+                button->type = MACRO;
+                if (readMacro(button->value, button->macro, numMotors) == 0) {
+                    fprintf(stderr, "formatting error reading macro %s\n", button->value);
+                    return 6;
+                }
+            }
+        }
+    }
+
+    // where a record button's macro goes
+    for (i = 0; i < NUM_BUTTONS && binding->buttons[i].type != RECORD; i++);
+    if (i < NUM_BUTTONS) {
+        Recording *recording = &binding->recording;
+        char target[STRING_BUFFER_LENGTH];
+        getBindingString(config, binding, "record", "button", "", target, sizeof(target));
+        for (j = 0; j < NUM_BUTTONS && strcmp(target, buttonnames[j]) != 0; j++);
+        if (j == NUM_BUTTONS || binding->buttons[j].type == RECORD) {
+            fprintf(stderr, "[record] button %s isn't a button that can be recorded to\n", target);
+            return 6;
+        }
+        recording->target = &binding->buttons[j];
+        char defaultFile[sizeof(binding->name) + sizeof("-recorded.txt")]; // big enough for any name
+        snprintf(defaultFile, sizeof(defaultFile), "%s%srecorded.txt", binding->name, binding->name[0] != '\0' ? "-" : "");
+        getBindingString(config, binding, "record", "file", defaultFile, recording->file, sizeof(recording->file));
+        recording->interval = getBindingInt(config, binding, "record", "interval", RECORD_INTERVAL);
+        recording->maxError = getBindingFloat(config, binding, "record", "max_error", RECORD_MAX_ERROR);
+        if (recording->interval <= 0) recording->interval = RECORD_INTERVAL;
+        if (recording->maxError < 0) recording->maxError = RECORD_MAX_ERROR;
+        robotstate->recording = recording;
+        printBinding(binding);
+        printf("Recording to %s for %s, a sample every %lu ms, max error %f\n", recording->file, target, recording->interval, recording->maxError);
+    }
+
+    // print a summary of the buttons, four to a line
+    for (i = 0; i < NUM_BUTTONS; i++) {
+        if (i % 4 == 0) {
+            printBinding(binding);
+            printf("Using ");
+        }
+        printf("%s=%s%s", buttonnames[i], binding->buttons[i].value, i % 4 == 3 || i == NUM_BUTTONS-1 ? "\n" : ", ");
+    }
+
+    return 0;
+}
+
+// Stop the robot and close its connection and joystick, saving anything recorded
+void closeBinding(robotBinding *binding) {
+    UDPremote *remote = &binding->remote;
+    saveRecording(&binding->recording, binding->numMotors);
+#ifdef __linux__
+    if (remote->useNative) {
+        sendPacket(remote, 255, 0); // make sure the motors are stopped before we go
+        nativeClose(&remote->native);
+        remote->useNative = 0;
+    }
+    else
+#endif
+    if (remote->packet && remote->udpsocket)
+        sendPacket(remote, 255, 0); // make sure the motors are stopped before we go
+    if (remote->packet)
+        SDLNet_FreePacket(remote->packet);
+    remote->packet = NULL;
+    if (remote->udpsocket)
+        SDLNet_UDP_Close(remote->udpsocket);
+    remote->udpsocket = NULL;
+    if (binding->joystick) {
+        removeInstance(binding);
+        SDL_JoystickClose(binding->joystick);
+    }
+    binding->joystick = NULL;
+}
+
+
+// The joystick's serial number, or an empty string if SDL doesn't know it
+static void joystickSerial(SDL_Joystick *joystick, char *serial, int length) {
+    const char *value = NULL;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    value = SDL_JoystickGetSerial(joystick);
+#else
+    (void)joystick;
+#endif
+    snprintf(serial, length, "%s", value != NULL ? value : "");
+}
+
+// Call after loadBinding(), so that the joystick's current position goes into the pipeline
+int attachJoystick(robotBinding *binding, int deviceIndex) {
+    SDL_Joystick *joystick = SDL_JoystickOpen(deviceIndex);
+    if (joystick == NULL) {
+        fprintf(stderr, "Error: %s\n", SDL_GetError());
+        return 0;
+    }
+    binding->joystick = joystick;
+    binding->robotstate.joystick = joystick;
+    binding->instance = SDL_JoystickInstanceID(joystick);
+    binding->guid = SDL_JoystickGetGUID(joystick);
+    joystickSerial(joystick, binding->serial, sizeof(binding->serial));
+    binding->hasGuid = 1;
+    binding->last_input = SDL_GetTicks();
+    addInstance(binding);
+    readPipelineInputs(&binding->pipeline, joystick);
+
+    printBinding(binding);
+    printf("Using joystick %i, %s\n", deviceIndex, SDL_JoystickName(joystick));
+    return 1;
+}
+
+// The joystick has gone, stop its robot until it comes back
+void detachJoystick(robotBinding *binding) {
+    stopBinding(binding);
+    removeInstance(binding);
+    SDL_JoystickClose(binding->joystick);
+    binding->joystick = NULL;
+    binding->robotstate.joystick = NULL;
+    readPipelineInputs(&binding->pipeline, NULL);
+
+    printBinding(binding);
+    printf("Joystick removed, stopping motors until it's plugged back in\n");
+}
+
+// Which binding should take a newly plugged in joystick, NULL for none
+robotBinding *bindingForDevice(robotBinding *bindings, int numBindings, int deviceIndex) {
+    if (findBinding(SDL_JoystickGetDeviceInstanceID(deviceIndex)) != NULL) {
+        return NULL; // already open, e.g. from startup
+    }
+
+    // the joystick a binding had before it was unplugged, by serial number if
+    // there is one, otherwise as long as only one binding had that model
+    SDL_JoystickGUID guid = SDL_JoystickGetDeviceGUID(deviceIndex);
+    char serial[STRING_BUFFER_LENGTH*2] = "";
+    SDL_Joystick *joystick = SDL_JoystickOpen(deviceIndex);
+    if (joystick != NULL) {
+        joystickSerial(joystick, serial, sizeof(serial));
+        SDL_JoystickClose(joystick); // attachJoystick() opens it again
+    }
+    robotBinding *match = NULL;
+    int matches = 0;
+    for (int i = 0; i < numBindings; i++) {
+        if (bindings[i].joystick == NULL && bindings[i].hasGuid && memcmp(&bindings[i].guid, &guid, sizeof(guid)) == 0) {
+            if (serial[0] != '\0' && strcmp(bindings[i].serial, serial) == 0) {
+                return &bindings[i];
+            }
+            match = &bindings[i];
+            matches++;
+        }
+    }
+    if (matches == 1) {
+        return match;
+    }
+    if (matches > 1) {
+        // guessing could hand one operator's robot to someone else's joystick
+        printTime();
+        printf("Joystick %i is the same model as %i unplugged joysticks, not guessing which, restart to use it\n", deviceIndex, matches);
+        return NULL;
+    }
+
+    // or one that's still waiting for its joystick to turn up
+    for (int i = 0; i < numBindings; i++) {
+        if (bindings[i].joystick == NULL && !bindings[i].hasGuid && bindings[i].deviceIndex == deviceIndex) {
+            return &bindings[i];
+        }
+    }
+    return NULL;
+}
+
+
+// Emergency stop the robot and forget what it was doing
+void stopBinding(robotBinding *binding) {
+    robotState *robotstate = &binding->robotstate;
+    sendPacket(&binding->remote, 255, 0);
+    robotstate->enabled = 0;
+    for (int i = 0; i < robotstate->numMotors; i++) {
+        robotstate->axis[i] = 0;
+    }
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        if (robotstate->macros[i].length != 0) {
+            robotstate->macros[i].running = 0;
+        }
+    }
+}
+
+// Handle input from the binding's joystick
+void bindingEvent(robotBinding *binding, const SDL_Event *event) {
+    int button = -1;
+    switch (event->type) {
+        case SDL_JOYAXISMOTION:  /* Handle Joystick Motion */
+            setPipelineInput(&binding->pipeline, event->jaxis.axis, event->jaxis.value);
+            break;
+
+        case SDL_JOYBUTTONDOWN:  /* Handle Joystick Button Presses */
+            button = event->jbutton.button;
+            break;
+
+        case SDL_JOYHATMOTION:  /* Handle Hat Motion, the D-pad buttons come after the others */
+            if (event->jhat.value == 1) {
+                button = NUM_BUTTONS-4; // up
+            }
+            else if (event->jhat.value == 4) {
+                button = NUM_BUTTONS-3; // down
+            }
+            else if (event->jhat.value == 8) {
+                button = NUM_BUTTONS-2; // left
+            }
+            else if (event->jhat.value == 2) {
+                button = NUM_BUTTONS-1; // right
+            }
+            break;
+    }
+    if (button >= 0 && button < NUM_BUTTONS) {
+        printBinding(binding);
+        printf("%s button: ", buttonnames[button]);
+        executeButton(&binding->remote, &binding->robotstate, &binding->buttons[button]);
+    }
+
+    binding->last_input = SDL_GetTicks();
+}
+
+// Everything the control loop does for one robot besides handling input
+void updateBinding(robotBinding *binding, unsigned long now) {
+    UDPremote *remote = &binding->remote;
+    robotState *robotstate = &binding->robotstate;
+    inputPipeline *pipeline = &binding->pipeline;
+
+    // recieve all waiting packets, before any heartbeat still waiting for a reply is counted as lost
+    Uint32 packetID, command, argument;
+    while (receivePacket(remote, &packetID, &command, &argument) == 1) {
+        if (command == 1) { // EHLO
+            linkReply(&remote->link, argument, SDL_GetTicks());
+        }
+        else if (command == 4) { // capability
+            if (capabilityReply(remote, argument, binding->numMotors) && remote->caps.state != CAPS_OK && robotstate->enabled == 1) {
+                robotstate->enabled = 0;
+                printBinding(binding);
+                printf("Disabling motors\n");
+            }
+        }
+        else {
+            printBinding(binding);
+            printf("Packet recieved...\n");
+        }
+    }
+
+
+    // heart beat, also used to measure the link
+    now = SDL_GetTicks();
+    if (now - remote->link.lastHeartbeat > remote->link.interval) {
+        sendHeartbeat(remote, binding->control_priority, now); // the receiver uses this to arbitrate between controllers
+    }
+    if (remote->caps.state == CAPS_UNKNOWN && now - remote->caps.lastRequest > CAPABILITY_RETRY) {
+        requestCapabilities(remote, binding->numMotors, now); // nothing can be enabled until this is answered
+    }
+    if (updateLink(remote, now)) {
+        printBinding(binding);
+        printf("Link loss %.1f%%, rtt %.1f ms, heartbeat every %lu ms, %i redundant setpoints, receiver timeout %lu ms\n", \
+            remote->link.loss * 100, remote->link.rtt, remote->link.interval, remote->link.redundancy, remote->link.timeout);
+    }
+
+
+    // idle time out
+    if (SDL_GetTicks() - binding->last_input > binding->idle_timeout && robotstate->enabled == 1) {
+        stopBinding(binding);
+        printBinding(binding);
+        printf("Idle after %li seconds, stopping motors...\n", binding->idle_timeout/1000);
+    }
+
+
+    mixPipeline(pipeline, robotstate->axis);
+
+
+    // execute macros
+    now = SDL_GetTicks();
+    executeMacros(robotstate, binding->allbuttons, now);
+    recordSample(robotstate, now);
+
+
+    // send commands to the robot
+    now = SDL_GetTicks();
+    int changed = updateOutputs(pipeline, robotstate, now);
+    if (robotstate->enabled == 1) {
+        changed = linkRepeats(&remote->link, changed, now);
+    }
+    for (int i = 0; i < binding->numMotors; i++) {
+        if (changed & (1 << i)) {
+            updateMotor(remote, (i+1)*10, pipeline->output[i], binding->trim_min[i], binding->trim_max[i], binding->axis_dir[i]);
+        }
+    }
+    flushPackets(remote);
+}
+
+static void soonest(long *due, long wait) {
+    if (wait < 0) wait = 0;
+    if (*due == -1 || wait < *due) *due = wait;
+}
+
+// ms until updateBinding() next has something to do without any input or
+// replies arriving, -1 if it's only waiting on those
+long bindingDue(const robotBinding *binding, unsigned long now) {
+    const UDPremote *remote = &binding->remote;
+    const linkQuality *link = &remote->link;
+    const robotState *robotstate = &binding->robotstate;
+    long due = -1;
+
+    soonest(&due, (long)(link->lastHeartbeat + link->interval + 1 - now));
+    if (remote->caps.state == CAPS_UNKNOWN) {
+        soonest(&due, (long)(remote->caps.lastRequest + CAPABILITY_RETRY + 1 - now));
+    }
+    if (robotstate->enabled == 1) {
+        for (int i = 0; i < binding->numMotors; i++) {
+            if (link->repeats[i] > 0) {
+                soonest(&due, (long)(link->lastRepeat + REDUNDANCY_SPACING - now));
+            }
+        }
+        if (!outputsSettled(&binding->pipeline, robotstate)) {
+            soonest(&due, 0); // still slew limiting
+        }
+    }
+    long wait = macroDue(robotstate, now);
+    if (wait != -1) soonest(&due, wait);
+    wait = recordingDue(robotstate, now);
+    if (wait != -1) soonest(&due, wait);
+    return due;
+}
+
+// Wait up to timeout ms for joystick input or a packet from any of the
+// robots, returns 1 if there's something to handle. SDL can't wait on
+// sockets, so they're waited on a slice at a time with joystick input
+// checked in between, SDL_WaitEventTimeout() polls in the same way.
+int waitForInput(robotBinding *bindings, int numBindings, SDLNet_SocketSet sockets, long timeout) {
+    int sdlSockets = 0;
+#ifdef __linux__
+    nativeSocket *native[MAX_BINDINGS];
+    int numNative = 0;
+#endif
+    for (int i = 0; i < numBindings; i++) {
+#ifdef __linux__
+        if (bindings[i].remote.useNative) {
+            native[numNative++] = &bindings[i].remote.native;
+            continue;
+        }
+#endif
+        sdlSockets++;
+    }
+
+    unsigned long start = SDL_GetTicks();
+    long remaining = timeout;
+    while (1) {
+        SDL_PumpEvents();
+        if (SDL_HasEvents(SDL_FIRSTEVENT, SDL_LASTEVENT)) {
+            return 1;
+        }
+        long slice = remaining < WAIT_SLICE ? remaining : WAIT_SLICE;
+#ifdef __linux__
+        if (numNative > 0 && nativeWaitAny(native, numNative, sdlSockets > 0 ? 0 : slice)) {
+            return 1;
+        }
+#endif
+        if (sdlSockets > 0 && SDLNet_CheckSockets(sockets, slice) > 0) {
+            return 1;
+        }
+        remaining = timeout - (long)(SDL_GetTicks() - start);
+        if (remaining <= 0) {
+            return 0;
+        }
+    }
+}
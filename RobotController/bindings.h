@@ -0,0 +1,76 @@
+#ifndef _BINDINGS_H_
+#define _BINDINGS_H_ 1
+
+/* A binding ties one joystick to one robot, with everything that robot needs:
+ * its connection, state, input pipeline, trims, buttons and macros. Several
+ * bindings can run in the one control loop, events from each joystick are
+ * routed to its binding by SDL instance ID. */
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_net.h>
+#ifdef __linux__
+    #include <glib.h>
+#endif
+
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define MAX_BINDINGS 8
+#define INSTANCE_SLOTS 16 // size of the instance ID lookup table, a power of two above MAX_BINDINGS
+#define BUTTON_VALUE_LENGTH (STRING_BUFFER_LENGTH*4) // long enough for a macro's path
+#define WAIT_SLICE 1 // ms spent waiting on the sockets between checks for joystick input
+
+// where settings come from
+#ifdef __linux__
+typedef GKeyFile *configFile;
+#else
+typedef const char *configFile; // file name for GetPrivateProfile*()
+#endif
+
+typedef struct {
+    char name[STRING_BUFFER_LENGTH]; // empty for the binding set up by the plain sections
+    int deviceIndex; // joystick to open at startup
+    SDL_Joystick *joystick; // NULL while unplugged
+    SDL_JoystickID instance;
+    SDL_JoystickGUID guid; // so the same joystick is picked up when it's plugged back in
+    char serial[STRING_BUFFER_LENGTH*2]; // the GUID is only the model, this tells two the same apart, empty if unknown
+    int hasGuid;
+
+    UDPremote remote;
+    robotState robotstate;
+    inputPipeline pipeline;
+    Macro macros[NUM_BUTTONS];
+    buttonDefinition buttons[NUM_BUTTONS];
+    buttonDefinition *allbuttons[NUM_BUTTONS]; // for executeMacros()
+    char buttonvalues[NUM_BUTTONS][BUTTON_VALUE_LENGTH];
+    Recording recording;
+
+    int numMotors;
+    int trim_min[MAX_NUM_MOTORS];
+    int trim_max[MAX_NUM_MOTORS];
+    int axis_dir[MAX_NUM_MOTORS];
+    int control_priority;
+    unsigned long idle_timeout;
+    unsigned long last_input;
+} robotBinding;
+
+int getBindingInt(configFile config, const robotBinding *binding, const char *section, const char *key, int def);
+float getBindingFloat(configFile config, const robotBinding *binding, const char *section, const char *key, float def);
+void getBindingString(configFile config, const robotBinding *binding, const char *section, const char *key, const char *def, char *value, int length);
+
+void printBinding(const robotBinding *binding);
+int loadBinding(robotBinding *binding, configFile config);
+void closeBinding(robotBinding *binding);
+
+int attachJoystick(robotBinding *binding, int deviceIndex);
+void detachJoystick(robotBinding *binding);
+robotBinding *findBinding(SDL_JoystickID instance);
+robotBinding *bindingForDevice(robotBinding *bindings, int numBindings, int deviceIndex);
+
+void stopBinding(robotBinding *binding);
+void bindingEvent(robotBinding *binding, const SDL_Event *event);
+void updateBinding(robotBinding *binding, unsigned long now);
+long bindingDue(const robotBinding *binding, unsigned long now);
+int waitForInput(robotBinding *bindings, int numBindings, SDLNet_SocketSet sockets, long timeout);
+
+#endif /* _BINDINGS_H_ */
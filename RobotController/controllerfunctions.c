@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <sys/timeb.h>
 
 #include "../robot.h"
@@ -8,7 +10,7 @@
 #include "controllerfunctions.h"
 
 #ifdef DEBUG // so that we can get around debug compile error for defined but not used
-char** getMotorNames() {
+const char *const *getMotorNames() {
     return motornames;
 }
 #endif
@@ -17,29 +19,329 @@ void printTime() {
     struct timeb now;
     char buffer[26];
     ftime(&now);
+#ifdef __linux__
+    // localtime() rereads the time zone each call (allocating as it goes), localtime_r() doesn't
+    struct tm mytimebuffer;
+    struct tm *mytime = localtime_r(&now.time, &mytimebuffer);
+#else
     struct tm *mytime = localtime(&now.time);
+#endif
     strftime(buffer, 26, "%H:%M:%S.", mytime);
     printf("%s%03i ", buffer, now.millitm);
 }
 
 void sendPacket(UDPremote *remote, Uint32 command, Uint32 argument) {
-    remote->packet->address.host = remote->remoteAddr.host;
-    remote->packet->address.port = remote->remoteAddr.port;
-
+    Uint8 data[12];
     remote->nextpacket++;
-    SDLNet_Write32(remote->nextpacket, remote->packet->data);
-    SDLNet_Write32(command, remote->packet->data+4);
-    SDLNet_Write32(argument, remote->packet->data+8);
+    if (remote->emulatedLoss > 0 && command != 255 && rand() < remote->emulatedLoss * RAND_MAX) {
+        remote->dropped++;
+        remote->lastPacketTime = SDL_GetTicks();
+        return;
+    }
+    SDLNet_Write32(remote->nextpacket, data);
+    SDLNet_Write32(command, data+4);
+    SDLNet_Write32(argument, data+8);
+    sendRawPacket(remote, data, 12);
+    if (command == 255) { // don't hold back an emergency stop
+        flushPackets(remote);
+    }
+//    printf("sending packet %i, %i, %i\n", remote->nextpacket, command, argument);
+}
 
-    remote->packet->len = 12;
+// Send a packet exactly as given, up to PACKET_LENGTH bytes
+void sendRawPacket(UDPremote *remote, const Uint8 *data, int len) {
+    if (len > PACKET_LENGTH) len = PACKET_LENGTH;
+    if (len < 0) len = 0;
+#ifdef __linux__
+    if (remote->useNative) {
+        nativeQueue(&remote->native, data, len);
+        remote->lastPacketTime = SDL_GetTicks();
+        return;
+    }
+#endif
+    remote->packet->address.host = remote->remoteAddr.host;
+    remote->packet->address.port = remote->remoteAddr.port;
+    memcpy(remote->packet->data, data, len);
+    remote->packet->len = len;
     SDLNet_UDP_Send(remote->udpsocket, -1, remote->packet);
     remote->lastPacketTime = SDL_GetTicks();
-//    printf("sending packet %i, %i, %i\n", remote->nextpacket, command, argument);
+}
+
+// Send any packets the backend is holding on to, call once per loop
+void flushPackets(UDPremote *remote) {
+#ifdef __linux__
+    if (remote->useNative) {
+        nativeFlush(&remote->native);
+    }
+#else
+    (void)remote; // SDL_net sends straight away
+#endif
+}
+
+// Read the next waiting packet, returns 1 if a packet was read, 0 if there are none
+int receivePacket(UDPremote *remote, Uint32 *packetID, Uint32 *command, Uint32 *argument) {
+    Uint8 *data;
+    int len;
+#ifdef __linux__
+    Uint8 buffer[PACKET_LENGTH];
+#endif
+    do {
+#ifdef __linux__
+        if (remote->useNative) {
+            len = nativeRecv(&remote->native, buffer, PACKET_LENGTH);
+            data = buffer;
+        }
+        else
+#endif
+        {
+            if (SDLNet_UDP_Recv(remote->udpsocket, remote->packet) != 1) {
+                return 0;
+            }
+            len = remote->packet->len;
+            data = remote->packet->data;
+        }
+        if (len <= 0) {
+            return 0;
+        }
+    } while (len < 12); // skip anything too short to be one of ours
+
+    *packetID = SDLNet_Read32(data);
+    *command = SDLNet_Read32(data+4);
+    *argument = SDLNet_Read32(data+8);
+    return 1;
+}
+
+void initLink(linkQuality *link, unsigned long minInterval, unsigned long maxInterval, int maxRedundancy) {
+    memset(link, 0, sizeof(linkQuality));
+    link->minInterval = minInterval;
+    link->maxInterval = maxInterval;
+    link->interval = minInterval; // learn about the link quickly to start with
+    link->safeTimeout = CONTROLLER_TIMEOUT; // what a new session on the receiver starts with
+    link->maxRedundancy = maxRedundancy;
+}
+
+// Send a heartbeat, remembering when so that its reply can be timed
+void sendHeartbeat(UDPremote *remote, Uint32 argument, unsigned long now) {
+    linkQuality *link = &remote->link;
+    sendPacket(remote, 0, argument);
+    link->heartbeatIDs[link->nextHeartbeat] = remote->nextpacket;
+    link->heartbeatTimes[link->nextHeartbeat] = now;
+    link->heartbeatPending[link->nextHeartbeat] = 1;
+    link->nextHeartbeat = (link->nextHeartbeat + 1) % LINK_HISTORY;
+    link->lastHeartbeat = now;
+    if (link->nextHeartbeat % LINK_ANNOUNCE_EVERY == 0 || link->timeout > link->safeTimeout) {
+        link->announce = 1;
+    }
+}
+
+// Record whether a heartbeat was answered, loss is the fraction lost out of the last LINK_WINDOW
+void linkOutcome(linkQuality *link, int lost) {
+    if (link->numOutcomes == LINK_WINDOW) {
+        link->lostCount -= link->outcomes[link->nextOutcome];
+    }
+    else {
+        link->numOutcomes++;
+    }
+    link->outcomes[link->nextOutcome] = lost;
+    link->lostCount += lost;
+    link->nextOutcome = (link->nextOutcome + 1) % LINK_WINDOW;
+    link->loss = (float)link->lostCount / link->numOutcomes;
+}
+
+// An EHLO came back, its argument is the ID of the heartbeat it answers
+void linkReply(linkQuality *link, Uint32 heartbeatID, unsigned long now) {
+    for (int i = 0; i < LINK_HISTORY; i++) {
+        if (link->heartbeatPending[i] && link->heartbeatIDs[i] == heartbeatID) {
+            link->heartbeatPending[i] = 0;
+            float sample = now - link->heartbeatTimes[i];
+            if (link->rtt == 0) {
+                link->rtt = sample;
+                link->rttvar = sample / 2;
+            }
+            else { // as TCP does it
+                link->rttvar += LINK_GAIN * (fabsf(sample - link->rtt) - link->rttvar);
+                link->rtt += LINK_GAIN * (sample - link->rtt);
+            }
+            linkOutcome(link, 0);
+            return;
+        }
+    }
+}
+
+// Count unanswered heartbeats as lost, then adapt the heartbeat interval,
+// redundancy and receiver timeout to match. Returns 1 if something changed.
+int updateLink(UDPremote *remote, unsigned long now) {
+    linkQuality *link = &remote->link;
+    unsigned long replyTimeout = link->maxInterval; // until there's a round trip time to go on
+    if (link->rtt > 0) {
+        replyTimeout = link->rtt + 4 * link->rttvar;
+        if (replyTimeout < LINK_MIN_REPLY_TIMEOUT) replyTimeout = LINK_MIN_REPLY_TIMEOUT;
+    }
+    for (int i = 0; i < LINK_HISTORY; i++) {
+        if (link->heartbeatPending[i] && now - link->heartbeatTimes[i] > replyTimeout) {
+            link->heartbeatPending[i] = 0;
+            linkOutcome(link, 1);
+        }
+    }
+
+    // heartbeat more often on a bad link (or one we don't know much about yet)
+    // to learn about it quicker
+    float scale = link->loss / LINK_LOSS_FOR_MIN_INTERVAL;
+    if (scale > 1 || link->numOutcomes < LINK_WINDOW) scale = 1;
+    unsigned long interval = link->maxInterval - (link->maxInterval - link->minInterval) * scale;
+
+    // send enough copies of each setpoint that all of them being lost is unlikely,
+    // and have the receiver give up after enough heartbeats have been missed
+    // that it's probably not just loss
+    int redundancy = 0;
+    unsigned long timeout = CONTROLLER_TIMEOUT;
+    if (link->loss >= 1) { // a dead link, or a standby controller the receiver isn't answering
+        redundancy = link->maxRedundancy;
+    }
+    else {
+        int missed = 3;
+        if (link->loss > LINK_TARGET_LOSS) {
+            float copies = logf(LINK_TARGET_LOSS) / logf(link->loss);
+            redundancy = (int)ceilf(copies) - 1;
+            if (copies > missed) missed = (int)ceilf(copies);
+        }
+        timeout = missed * interval + link->rtt + 4 * link->rttvar;
+    }
+    if (redundancy > link->maxRedundancy) redundancy = link->maxRedundancy;
+    if (redundancy < 0) redundancy = 0;
+    if (timeout < MIN_CONTROLLER_TIMEOUT) timeout = MIN_CONTROLLER_TIMEOUT;
+    if (timeout > CONTROLLER_TIMEOUT) timeout = CONTROLLER_TIMEOUT;
+
+    int changed = redundancy != link->redundancy;
+    link->redundancy = redundancy;
+    if (link->timeout == 0 || timeout * 10 < link->timeout * 9 || timeout * 10 > link->timeout * 11) {
+        link->timeout = timeout;
+        link->announced = 0;
+        link->announce = 1;
+        changed = 1;
+    }
+    if (!supportsCommand(remote, OPTIONAL_TIMEOUT)) {
+        link->safeTimeout = CONTROLLER_TIMEOUT; // the receiver always uses its own
+    }
+    else if (link->announce) { // also repeated every few heartbeats in case it was lost
+        sendPacket(remote, 2, link->timeout); // tell the receiver
+        link->announced++;
+    }
+    link->announce = 0;
+
+    // a shorter timeout is safe straight away, a longer one only once it's
+    // probably got through, until then the receiver could still be using the old one
+    if (link->timeout < link->safeTimeout || link->announced >= LINK_ANNOUNCE_CONFIRM) {
+        link->safeTimeout = link->timeout;
+    }
+    if (interval > link->safeTimeout / 3) interval = link->safeTimeout / 3;
+    if (interval < link->minInterval) interval = link->minInterval;
+    link->interval = interval;
+    return changed;
+}
+
+// Given the motors whose setpoints just changed, returns the motors that need
+// sending this tick including any redundant copies that are due
+int linkRepeats(linkQuality *link, int changed, unsigned long now) {
+    int send = changed;
+    int due = now - link->lastRepeat >= REDUNDANCY_SPACING;
+    for (int i = 0; i < MAX_NUM_MOTORS; i++) {
+        if (changed & (1 << i)) {
+            link->repeats[i] = link->redundancy;
+        }
+        else if (due && link->repeats[i] > 0) {
+            link->repeats[i]--;
+            send |= 1 << i;
+        }
+    }
+    if (due) {
+        link->lastRepeat = now;
+    }
+    return send;
+}
+
+// Ask the receiver what it can do, telling it which protocol version we speak
+// and how many motors we're going to drive
+void requestCapabilities(UDPremote *remote, int numMotors, unsigned long now) {
+    remote->caps.received = 0;
+    remote->caps.lastRequest = now;
+    sendPacket(remote, 3, CAPABILITY(PROTOCOL_VERSION, numMotors));
+}
+
+// One capability has come back, once they all have check they match what we
+// need, returns 1 if the handshake state changed
+int capabilityReply(UDPremote *remote, Uint32 argument, int numMotors) {
+    capabilities *caps = &remote->caps;
+    unsigned long value = CAPABILITY_VALUE(argument);
+    capabilityState state;
+    switch (CAPABILITY_KEY(argument)) {
+        case CAP_VERSION: caps->version = value; break;
+        case CAP_MOTORS: caps->numMotors = value; break;
+        case CAP_PWMRANGE: caps->pwmRange = value; break;
+        case CAP_COMMANDS: caps->commands = value; break;
+        case CAP_END: break;
+        default: return 0; // from a newer receiver, ignore
+    }
+    if (CAPABILITY_KEY(argument) != CAP_END) {
+        caps->received |= 1 << CAPABILITY_KEY(argument);
+        return 0;
+    }
+
+    // the end's value is whether the receiver accepted our request
+    if (caps->received != (1 << CAP_VERSION | 1 << CAP_MOTORS | 1 << CAP_PWMRANGE | 1 << CAP_COMMANDS)) {
+        state = CAPS_UNKNOWN; // an end on its own means the receiver has forgotten us, e.g. it was reset
+    }
+    else if (caps->version != PROTOCOL_VERSION || caps->numMotors < (unsigned long)numMotors || caps->pwmRange == 0 || !value) {
+        state = CAPS_MISMATCH;
+    }
+    else {
+        state = CAPS_OK;
+        remote->link.announce = 1; // a new session on the receiver needs our timeout
+    }
+    caps->received = 0;
+    if (state == caps->state) {
+        return 0; // only said once, a refusal would otherwise be repeated every retry
+    }
+    caps->state = state;
+
+    printTime();
+    if (state == CAPS_UNKNOWN) {
+        printf("Receiver needs capabilities agreeing again\n");
+    }
+    else if (caps->version != PROTOCOL_VERSION) {
+        printf("Receiver speaks protocol version %lu, we speak %i, not enabling\n", caps->version, PROTOCOL_VERSION);
+    }
+    else if (caps->numMotors < (unsigned long)numMotors) {
+        printf("Receiver has %lu motors, config.ini wants %i, not enabling\n", caps->numMotors, numMotors);
+    }
+    else if (state == CAPS_MISMATCH) {
+        printf("Receiver refused the capability handshake, not enabling\n");
+    }
+    else {
+        printf("Receiver protocol version %lu, %lu motors, PWM range %lu, optional commands 0x%lx\n", \
+            caps->version, caps->numMotors, caps->pwmRange, caps->commands);
+    }
+    return 1;
+}
+
+// Whether the receiver handles an optional command, assumed so until we know otherwise
+int supportsCommand(const UDPremote *remote, unsigned long optional) {
+    return remote->caps.state != CAPS_OK || (remote->caps.commands & optional);
 }
 
 void executeButton(UDPremote *remote, robotState *robotstate, const buttonDefinition *button) {
     switch (button->type) {
         case ENABLE:
+            if (remote->caps.state == CAPS_MISMATCH) {
+                // it isn't asked again by itself, but the receiver may have been updated since
+                printf("Not enabling motors, the receiver's capabilities don't match, asking again\n");
+                requestCapabilities(remote, robotstate->numMotors, SDL_GetTicks());
+                break;
+            }
+            if (remote->caps.state != CAPS_OK) {
+                printf("Not enabling motors, the receiver's capabilities aren't known yet\n");
+                break;
+            }
             for (int i = 0; i < robotstate->numMotors; i++) {
                 sendPacket(remote, (i+1)*10, 0); // enable (motor IDs start at 0, but packets start at 10)
             }
@@ -61,12 +363,25 @@ void executeButton(UDPremote *remote, robotState *robotstate, const buttonDefini
                     robotstate->macros[i].running = 0;
                 }
             }
-            for (int i = 0; i < robotstate->numMotors; i++) {
-                robotstate->axis[i] = axisvalueconversion(SDL_JoystickGetAxis(joystick, robotstate->axismap[i]));
-            }
+            readPipelineInputs(robotstate->pipeline, robotstate->joystick);
+            mixPipeline(robotstate->pipeline, robotstate->axis);
             printf("Interrupting running macros\n");
             break;
 
+        case RECORD:
+            if (robotstate->recording == NULL || robotstate->recording->target == NULL) {
+                printf("Nowhere to record to\n");
+            }
+            else if (robotstate->recording->started == 0) {
+                startRecording(robotstate->recording, SDL_GetTicks());
+                printf("Recording to %s, press again to stop\n", robotstate->recording->file);
+            }
+            else {
+                printf("Recording stopped\n");
+                finishRecording(robotstate, SDL_GetTicks());
+            }
+            break;
+
         case EXIT:
             printf("Exit?\n");
             SDL_Event sdlevent;
@@ -123,6 +438,56 @@ void executeButton(UDPremote *remote, robotState *robotstate, const buttonDefini
     }
 }
 
+// Step running macros on, a step is sent once the macro has been running past
+// the end of the previous step (but not past the end of its own)
+void executeMacros(robotState *robotstate, buttonDefinition **allbuttons, unsigned long now) {
+    Macro *macros = robotstate->macros;
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        if (macros[i].length > 0 && macros[i].running > 0) {
+            if (macros[i].at == 0 || (macros[i].at < macros[i].length && now - macros[i].running < macros[i].times[macros[i].at] && now - macros[i].running > macros[i].times[macros[i].at-1])) {
+                printTime();
+                printf("Macro %s command %i/%i (", allbuttons[i]->value, macros[i].at+1, macros[i].length);
+                for (int j = 0; j < robotstate->numMotors; j++) {
+                    if (j > 0) {
+                        printf(", ");
+                    }
+                    printf("%f", macros[i].velocities[j][macros[i].at]);
+                }
+                printf(")\n");
+
+                for (int j = 0; j < robotstate->numMotors; j++) {
+                    robotstate->axis[j] = macros[i].velocities[j][macros[i].at];
+                }
+                macros[i].at++;
+            }
+            else if (now - macros[i].running > macros[i].times[macros[i].at-1]) {
+                printTime();
+                printf("Macro %s finished\n", allbuttons[i]->value);
+                readPipelineInputs(robotstate->pipeline, robotstate->joystick);
+                mixPipeline(robotstate->pipeline, robotstate->axis);
+                macros[i].running = 0;
+            }
+        }
+    }
+}
+
+// ms until executeMacros() next has a step to send or a macro to finish, -1 if none are running
+long macroDue(const robotState *robotstate, unsigned long now) {
+    const Macro *macros = robotstate->macros;
+    long due = -1;
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        if (macros[i].length > 0 && macros[i].running > 0) {
+            long wait = 0;
+            if (macros[i].at > 0) { // when the macro has run past the end of the last step sent
+                wait = (long)(macros[i].running + macros[i].times[macros[i].at-1] + 1 - now);
+            }
+            if (wait < 0) wait = 0;
+            if (due == -1 || wait < due) due = wait;
+        }
+    }
+    return due;
+}
+
 #ifdef __linux__
 int getIntFromConfig(GKeyFile* gkf, const char *section, const char *key, const int def) {
     if (gkf == NULL) {
@@ -151,6 +516,19 @@ char* getStringFromConfig(GKeyFile* gkf, const char *section, const char *key, c
     }
     return temp;
 }
+
+float getFloatFromConfig(GKeyFile* gkf, const char *section, const char *key, const float def) {
+    if (gkf == NULL) {
+        return def;
+    }
+    GError *gerror = NULL;
+    float temp = g_key_file_get_double(gkf, section, key, &gerror);
+    if (gerror != NULL) {
+        temp = def;
+        g_error_free(gerror);
+    }
+    return temp;
+}
 #endif
 
 void copystate(robotState *src, robotState *dest) {
@@ -161,41 +539,70 @@ void copystate(robotState *src, robotState *dest) {
         dest->axis[i] = src->axis[i];
     }
     dest->macros = src->macros;
-    dest->axismap = src->axismap;
+    dest->pipeline = src->pipeline;
+    dest->joystick = src->joystick;
+    dest->recording = src->recording;
     dest->numMotors = src->numMotors;
 }
 
+// Trims are in MYPWMRANGE units, what's sent is in the receiver's own range
 void updateMotor(UDPremote *remote, int id, float value, int min, int max, int dir) {
+    float scale = remote->caps.pwmRange ? (float)remote->caps.pwmRange / MYPWMRANGE : 1;
     value *= dir;
     if (value > 0) {
-        sendPacket(remote, id+5, (int)((max - min) * value + min));
+        sendPacket(remote, id+5, (int)(((max - min) * value + min) * scale));
     }
     else if (value == 0) {
         sendPacket(remote, id+5, 0);
         sendPacket(remote, id+6, 0);
     }
     else { // value < 0
-        sendPacket(remote, id+6, (int)((max - min) * -value + min));
+        sendPacket(remote, id+6, (int)(((max - min) * -value + min) * scale));
+    }
+}
+
+// All macro steps come out of one pool allocated up front, so that macros can
+// be created while the control loop is running without calling malloc
+unsigned long macroTimes[MACRO_POOL_SIZE];
+float macroVelocities[MAX_NUM_MOTORS][MACRO_POOL_SIZE];
+int macroPoolUsed = 0;
+
+// Point a macro at enough of the pool for length steps, returns 0 if it's full
+int allocMacro(Macro *macro, int length) {
+    if (length <= 0 || macroPoolUsed + length > MACRO_POOL_SIZE) {
+        return 0;
+    }
+    macro->times = &macroTimes[macroPoolUsed];
+    for (int i = 0; i < MAX_NUM_MOTORS; i++) {
+        macro->velocities[i] = &macroVelocities[i][macroPoolUsed];
     }
+    macro->length = length;
+    macroPoolUsed += length;
+    return 1;
 }
 
 int readMacro(char filename[], Macro *macro, int numMotors) {
     FILE *fid = fopen(filename, "r");
-    int ret = fscanf(fid, "%i", &macro->length);
-    if (ret != 1 || macro->length <= 0) {
+    if (fid == NULL) {
+        return 0;
+    }
+    int length;
+    int ret = fscanf(fid, "%i", &length);
+    if (ret != 1 || length <= 0) {
         fclose(fid);
         return 0;
     }
 
     printTime();
-    printf("Reading macro %s, length %i\n", filename, macro->length);
-    macro->times = (unsigned long*)malloc(sizeof(int)*macro->length);
-    for (int i = 0; i < numMotors; i++) {
-        macro->velocities[i] = (float*)malloc(sizeof(float)*macro->length);
+    printf("Reading macro %s, length %i\n", filename, length);
+    if (allocMacro(macro, length) == 0) {
+        fprintf(stderr, "macro %s doesn't fit, MACRO_POOL_SIZE is %i steps\n", filename, MACRO_POOL_SIZE);
+        fclose(fid);
+        return 0;
     }
 
     for (int i = 0; i < macro->length; i++) {
-        ret = fscanf(fid, "%li", &macro->times[i]);
+        ret = fscanf(fid, "%lu", &macro->times[i]);
         if (ret != 1) {
             fclose(fid);
             return 0;
@@ -216,14 +623,331 @@ int readMacro(char filename[], Macro *macro, int numMotors) {
     return 1;
 }
 
+// Write a macro in the format readMacro() reads, each line's time is the step's length
+int writeMacro(const char filename[], const Macro *macro, int numMotors) {
+    FILE *fid = fopen(filename, "w");
+    if (fid == NULL) {
+        return 0;
+    }
+    fprintf(fid, "%i\n", macro->length);
+    for (int i = 0; i < macro->length; i++) {
+        fprintf(fid, "%lu", macro->times[i] - (i > 0 ? macro->times[i-1] : 0));
+        for (int j = 0; j < numMotors; j++) {
+            fprintf(fid, ",%g", macro->velocities[j][i]);
+        }
+        fprintf(fid, "\n");
+    }
+    return fclose(fid) == 0;
+}
+
+void startRecording(Recording *recording, unsigned long now) {
+    recording->started = now;
+    recording->lastSample = now - recording->interval; // take the first sample straight away
+    recording->length = 0;
+}
+
+// Sample the motor values if it's time to, stopping when the recording is full
+void recordSample(robotState *robotstate, unsigned long now) {
+    Recording *recording = robotstate->recording;
+    if (recording == NULL || recording->started == 0 || now - recording->lastSample < recording->interval) {
+        return;
+    }
+    if (recording->length == RECORD_LENGTH) {
+        printTime();
+        printf("Recording is full after %i samples\n", RECORD_LENGTH);
+        finishRecording(robotstate, now);
+        return;
+    }
+    recording->times[recording->length] = now - recording->started;
+    for (int j = 0; j < robotstate->numMotors; j++) {
+        recording->samples[j][recording->length] = robotstate->axis[j];
+    }
+    recording->length++;
+    recording->lastSample = now;
+}
+
+// ms until recordSample() next takes a sample, -1 if not recording
+long recordingDue(const robotState *robotstate, unsigned long now) {
+    const Recording *recording = robotstate->recording;
+    if (recording == NULL || recording->started == 0) {
+        return -1;
+    }
+    long wait = (long)(recording->lastSample + recording->interval - now);
+    return wait > 0 ? wait : 0;
+}
+
+// Reduce the recording in place to as few steps as possible, each holding the
+// middle of the range it covers (or 0 if that's close enough) so no sample is
+// more than maxError from it. A motor that was stopped (exactly 0) is only
+// ever in a step of its own, so that it stays stopped. Afterwards times are
+// when each step ends, returns the number of steps.
+int simplifyRecording(Recording *recording, int numMotors, unsigned long duration, float *error) {
+    float lo[MAX_NUM_MOTORS], hi[MAX_NUM_MOTORS];
+    int steps = 0;
+    int start = 0;
+    *error = 0;
+    while (start < recording->length) {
+        int j, end;
+        for (j = 0; j < numMotors; j++) {
+            lo[j] = hi[j] = recording->samples[j][start];
+        }
+        // greedily take samples until one would make the range too wide, or
+        // would start or end a stop
+        for (end = start + 1; end < recording->length; end++) {
+            for (j = 0; j < numMotors; j++) {
+                float value = recording->samples[j][end];
+                if ((value > hi[j] ? value : hi[j]) - (value < lo[j] ? value : lo[j]) > 2 * recording->maxError) {
+                    break;
+                }
+                if ((lo[j] == 0 && hi[j] == 0) != (value == 0)) {
+                    break;
+                }
+            }
+            if (j < numMotors) {
+                break;
+            }
+            for (j = 0; j < numMotors; j++) {
+                float value = recording->samples[j][end];
+                if (value > hi[j]) hi[j] = value;
+                if (value < lo[j]) lo[j] = value;
+            }
+        }
+
+        // steps never overtake the samples they're made from
+        recording->times[steps] = end < recording->length ? recording->times[end] : duration;
+        for (j = 0; j < numMotors; j++) {
+            float value = (lo[j] + hi[j]) / 2;
+            if (hi[j] <= recording->maxError && lo[j] >= -recording->maxError) {
+                value = 0; // so that stopped stays stopped
+            }
+            recording->samples[j][steps] = value;
+            if (hi[j] - value > *error) *error = hi[j] - value;
+            if (value - lo[j] > *error) *error = value - lo[j];
+        }
+        steps++;
+        start = end;
+    }
+    return steps;
+}
+
+// Turn what's been recorded into a macro and bind it to the target button, it's saved by saveRecording()
+int finishRecording(robotState *robotstate, unsigned long now) {
+    Recording *recording = robotstate->recording;
+    buttonDefinition *target = recording->target;
+    unsigned long duration = now - recording->started;
+    int samples = recording->length;
+    recording->started = 0;
+    if (samples == 0) {
+        printTime();
+        printf("Nothing was recorded\n");
+        return 0;
+    }
+    if (duration <= recording->times[samples-1]) {
+        duration = recording->times[samples-1] + recording->interval;
+    }
+
+    float error;
+    int steps = simplifyRecording(recording, robotstate->numMotors, duration, &error);
+
+    // reuse the button's macro if the new one fits, the pool is never freed
+    Macro *macro = target->macro;
+    macro->running = 0;
+    if (target->type != MACRO || macro->length < steps) {
+        if (allocMacro(macro, steps) == 0) {
+            printTime();
+            printf("Recorded macro doesn't fit, MACRO_POOL_SIZE is %i steps\n", MACRO_POOL_SIZE);
+            return 0;
+        }
+    }
+    macro->length = steps;
+    for (int i = 0; i < steps; i++) {
+        macro->times[i] = recording->times[i];
+        for (int j = 0; j < robotstate->numMotors; j++) {
+            macro->velocities[j][i] = recording->samples[j][i];
+        }
+    }
+    target->type = MACRO;
+    target->value = recording->file;
+
+    recording->unsaved = 1;
+
+    printTime();
+    printf("Recorded %i samples over %lu ms as %i steps (%.1f:1), max error %f, saving to %s on exit\n", \
+        samples, duration, steps, (float)samples / steps, error, recording->file);
+    return 1;
+}
+
+// Write the last recorded macro to its file. Not done by finishRecording(), as
+// that's called from the control loop, and file I/O allocates and can block.
+int saveRecording(const Recording *recording, int numMotors) {
+    if (!recording->unsaved) {
+        return 1;
+    }
+    if (writeMacro(recording->file, recording->target->macro, numMotors) == 0) {
+        fprintf(stderr, "Couldn't write macro %s\n", recording->file);
+        return 0;
+    }
+    printTime();
+    printf("Macro %s saved\n", recording->file);
+    return 1;
+}
+
 float axisvalueconversion(Sint16 value) {
-    if (value < -DEADZONE ) { // up
-        return -((float)value + DEADZONE) / (JOYSTICK_MAX - DEADZONE);
+    return shapeAxisValue(value, DEADZONE, 0);
+}
+
+// Deadzone then expo, up is positive
+float shapeAxisValue(Sint16 value, int deadzone, float expo) {
+    float x;
+    if (value < -deadzone ) { // up
+        x = -((float)value + deadzone) / (JOYSTICK_MAX - deadzone);
     }
-    else if (value > DEADZONE) { // down
-        return -((float)value - DEADZONE) / (JOYSTICK_MAX - DEADZONE);
+    else if (value > deadzone) { // down
+        x = -((float)value - deadzone) / (JOYSTICK_MAX - deadzone);
     }
     else {
         return 0;
     }
+    return (1 - expo) * x + expo * x * x * x;
+}
+
+void initPipeline(inputPipeline *pipeline, int numAxes, int numMotors) {
+    memset(pipeline, 0, sizeof(inputPipeline));
+    pipeline->numAxes = numAxes;
+    pipeline->numMotors = numMotors;
+    for (int i = 0; i < numAxes; i++) {
+        buildAxisCurve(pipeline, i, DEADZONE, 0);
+    }
+    for (int i = 0; i < MAX_NUM_MOTORS; i++) {
+        pipeline->invertmap[i] = i;
+    }
+    if (numMotors >= 2) { // by default inverting swaps left and right
+        pipeline->invertmap[LEFT] = RIGHT;
+        pipeline->invertmap[RIGHT] = LEFT;
+    }
+}
+
+// Precompute the shaped value for every possible position of an axis
+void buildAxisCurve(inputPipeline *pipeline, int axis, int deadzone, float expo) {
+    for (int i = 0; i < JOYSTICK_RANGE; i++) {
+        pipeline->curves[axis][i] = shapeAxisValue(i - JOYSTICK_MAX, deadzone, expo);
+    }
+}
+
+void setMix(inputPipeline *pipeline, int motor, int axis, float weight) {
+    pipeline->mix[axis][motor] = weight;
+    if (weight != 0) {
+        pipeline->axismask[motor] |= 1u << axis;
+    }
+    else {
+        pipeline->axismask[motor] &= ~(1u << axis);
+    }
+}
+
+void setPipelineInput(inputPipeline *pipeline, int axis, Sint16 value) {
+    if (axis < pipeline->numAxes) {
+        pipeline->inputs[axis] = pipeline->curves[axis][value + JOYSTICK_MAX];
+        pipeline->changed |= 1u << axis;
+    }
+}
+
+void readPipelineInputs(inputPipeline *pipeline, SDL_Joystick *joystick) {
+    for (int i = 0; i < pipeline->numAxes; i++) {
+        setPipelineInput(pipeline, i, joystick ? SDL_JoystickGetAxis(joystick, i) : 0); // centred while unplugged
+    }
+}
+
+// Work out motor values from the axes, only motors using a changed axis are
+// updated so that axes which aren't mapped don't interrupt macros
+void mixPipeline(inputPipeline *pipeline, float *axis) {
+    if (pipeline->changed == 0) {
+        return;
+    }
+    // every motor at once, laid out so that the compiler can vectorise it
+    float mixed[MIX_WIDTH] = {0};
+    for (int i = 0; i < MAX_NUM_AXES; i++) {
+        for (int j = 0; j < MIX_WIDTH; j++) {
+            mixed[j] += pipeline->mix[i][j] * pipeline->inputs[i];
+        }
+    }
+    for (int j = 0; j < pipeline->numMotors; j++) {
+        if (pipeline->axismask[j] & pipeline->changed) {
+            axis[j] = mixed[j] > 1 ? 1 : (mixed[j] < -1 ? -1 : mixed[j]);
+        }
+    }
+    pipeline->changed = 0;
+}
+
+// What each motor should be sent, before slew limiting
+static void outputTargets(const inputPipeline *pipeline, const robotState *robotstate, float *target) {
+    for (int i = 0; i < MAX_NUM_MOTORS; i++) {
+        target[i] = 0;
+    }
+    for (int i = 0; i < pipeline->numMotors; i++) {
+        if (robotstate->invert == 1) {
+            target[pipeline->invertmap[i]] = -robotstate->axis[i] / robotstate->speed;
+        }
+        else {
+            target[i] = robotstate->axis[i] / robotstate->speed;
+        }
+    }
+}
+
+// Whether every output has caught up with its target, so that updateOutputs() has nothing to do
+int outputsSettled(const inputPipeline *pipeline, const robotState *robotstate) {
+    float target[MAX_NUM_MOTORS];
+    outputTargets(pipeline, robotstate, target);
+    for (int i = 0; i < pipeline->numMotors; i++) {
+        if (target[i] != pipeline->output[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Apply invert, speed and slew limits to the robot's axes, returns a bit set
+// for each motor whose output has changed and so needs sending
+int updateOutputs(inputPipeline *pipeline, const robotState *robotstate, unsigned long now) {
+    float target[MAX_NUM_MOTORS];
+    outputTargets(pipeline, robotstate, target);
+
+    unsigned long dt = now - pipeline->lastOutput;
+    pipeline->lastOutput = now;
+    int changed = 0;
+    for (int i = 0; i < pipeline->numMotors; i++) {
+        float value = target[i];
+        if (robotstate->enabled == 1 && pipeline->slew[i] > 0) {
+            float step = pipeline->slew[i] * dt;
+            if (value > pipeline->output[i] + step) {
+                value = pipeline->output[i] + step;
+            }
+            else if (value < pipeline->output[i] - step) {
+                value = pipeline->output[i] - step;
+            }
+        }
+        if (value != pipeline->output[i]) {
+            pipeline->output[i] = value;
+            changed |= 1 << i;
+        }
+    }
+
+    // nothing is sent while disabled
+    return robotstate->enabled == 1 ? changed : 0;
+}
+
+// Read a comma separated list of numbers, returns how many were read
+int parseFloatList(const char *str, float *values, int max) {
+    int count = 0;
+    char *end;
+    while (str != NULL && *str != '\0' && count < max) {
+        values[count++] = strtof(str, &end);
+        if (end == str) {
+            return count - 1;
+        }
+        str = end;
+        while (*str == ',' || *str == ' ') {
+            str++;
+        }
+    }
+    return count;
 }
@@ -6,34 +6,130 @@
 #include <SDL2/SDL_net.h>
 #ifdef __linux__
     #include <glib.h>
+    #include "nativeudp.h"
+    #include "realtime.h"
 #endif
 
 
 void printTime();
 
+// Link quality, estimated from heartbeat replies
+#define LINK_HISTORY 32 // heartbeats remembered for matching up replies
+#define LINK_GAIN 0.125 // weight of each new sample in the smoothed round trip time
+#define LINK_WINDOW 20 // heartbeats the loss estimate is worked out over
+#define LINK_TARGET_LOSS 0.001 // aim for a setpoint being lost less often than this
+#define LINK_LOSS_FOR_MIN_INTERVAL 0.2 // loss at which heartbeats are sent as often as allowed
+#define LINK_MIN_REPLY_TIMEOUT 50 // ms to wait for a reply before counting a heartbeat as lost
+#define LINK_ANNOUNCE_EVERY 8 // heartbeats between repeats of the timeout sent to the receiver
+#define LINK_ANNOUNCE_CONFIRM 3 // times a longer timeout is sent before heartbeats rely on it
+#define REDUNDANCY_SPACING 5 // ms between redundant copies of a setpoint
+typedef struct {
+    Uint32 heartbeatIDs[LINK_HISTORY];
+    unsigned long heartbeatTimes[LINK_HISTORY];
+    int heartbeatPending[LINK_HISTORY];
+    int nextHeartbeat;
+    unsigned long lastHeartbeat;
+    float rtt; // smoothed round trip time, ms
+    float rttvar; // smoothed round trip time variation, ms
+    int outcomes[LINK_WINDOW]; // 1 for each heartbeat that went unanswered
+    int nextOutcome;
+    int numOutcomes;
+    int lostCount;
+    float loss; // fraction of recent heartbeats going unanswered
+    unsigned long interval; // current heartbeat interval, ms
+    unsigned long minInterval;
+    unsigned long maxInterval;
+    int redundancy; // extra copies sent of each setpoint
+    int maxRedundancy;
+    int repeats[MAX_NUM_MOTORS]; // redundant copies still to send for each motor
+    unsigned long lastRepeat;
+    unsigned long timeout; // controller timeout announced to the receiver
+    unsigned long safeTimeout; // shortest timeout the receiver could still be using
+    int announced; // times the timeout has been sent since it last changed
+    int announce; // the timeout needs sending
+} linkQuality;
+
+// What the receiver told us it can do in the capability handshake
+typedef enum {CAPS_UNKNOWN, CAPS_OK, CAPS_MISMATCH} capabilityState;
+typedef struct {
+    capabilityState state;
+    unsigned long lastRequest;
+    unsigned int received; // bit set for each capability key seen since the last request
+    unsigned long version;
+    unsigned long numMotors;
+    unsigned long pwmRange;
+    unsigned long commands; // OPTIONAL_* bits
+} capabilities;
+
 typedef struct {
     UDPsocket udpsocket;
     IPaddress remoteAddr;
     UDPpacket *packet;
     Uint32 nextpacket;
     unsigned long lastPacketTime;
+    linkQuality link;
+    capabilities caps;
+    float emulatedLoss; // fraction of packets to drop, for testing
+    unsigned long dropped;
+#ifdef __linux__
+    int useNative; // send/receive through native instead of udpsocket
+    nativeSocket native;
+#endif
 } UDPremote;
 
 void sendPacket(UDPremote *remote, Uint32 command, Uint32 argument);
+void sendRawPacket(UDPremote *remote, const Uint8 *data, int len);
+void flushPackets(UDPremote *remote);
+int receivePacket(UDPremote *remote, Uint32 *packetID, Uint32 *command, Uint32 *argument);
+
+void initLink(linkQuality *link, unsigned long minInterval, unsigned long maxInterval, int maxRedundancy);
+void sendHeartbeat(UDPremote *remote, Uint32 argument, unsigned long now);
+void linkOutcome(linkQuality *link, int lost);
+void linkReply(linkQuality *link, Uint32 heartbeatID, unsigned long now);
+int updateLink(UDPremote *remote, unsigned long now);
+int linkRepeats(linkQuality *link, int changed, unsigned long now);
+
+void requestCapabilities(UDPremote *remote, int numMotors, unsigned long now);
+int capabilityReply(UDPremote *remote, Uint32 argument, int numMotors);
+int supportsCommand(const UDPremote *remote, unsigned long optional);
 
 void executeButton(UDPremote *remote, robotState *robottsate, const buttonDefinition *button);
 
+void executeMacros(robotState *robotstate, buttonDefinition **allbuttons, unsigned long now);
+long macroDue(const robotState *robotstate, unsigned long now);
+
 #ifdef __linux__
 int getIntFromConfig(GKeyFile* gkf, const char *section, const char *key, const int def);
 char* getStringFromConfig(GKeyFile* gkf, const char *section, const char *key, char *def);
+float getFloatFromConfig(GKeyFile* gkf, const char *section, const char *key, const float def);
 #endif
 
 void copystate(robotState *src, robotState *dest);
 
 void updateMotor(UDPremote *remote, int id, float value, int min, int max, int dir);
 
+int allocMacro(Macro *macro, int length);
 int readMacro(char filename[], Macro *macro, int numMotors);
+int writeMacro(const char filename[], const Macro *macro, int numMotors);
+
+void startRecording(Recording *recording, unsigned long now);
+void recordSample(robotState *robotstate, unsigned long now);
+long recordingDue(const robotState *robotstate, unsigned long now);
+int simplifyRecording(Recording *recording, int numMotors, unsigned long duration, float *error);
+int finishRecording(robotState *robotstate, unsigned long now);
+int saveRecording(const Recording *recording, int numMotors);
 
 float axisvalueconversion(Sint16 value);
+float shapeAxisValue(Sint16 value, int deadzone, float expo);
+
+void initPipeline(inputPipeline *pipeline, int numAxes, int numMotors);
+void buildAxisCurve(inputPipeline *pipeline, int axis, int deadzone, float expo);
+void setMix(inputPipeline *pipeline, int motor, int axis, float weight);
+void setPipelineInput(inputPipeline *pipeline, int axis, Sint16 value);
+void readPipelineInputs(inputPipeline *pipeline, SDL_Joystick *joystick);
+void mixPipeline(inputPipeline *pipeline, float *axis);
+int updateOutputs(inputPipeline *pipeline, const robotState *robotstate, unsigned long now);
+int outputsSettled(const inputPipeline *pipeline, const robotState *robotstate);
+int parseFloatList(const char *str, float *values, int max);
 
 #endif /* _CONTROLLERFUNCTIONS_H_ */
@@ -0,0 +1,252 @@
+/*
+
+linkbench
+
+Show how well setpoints get through as packet loss goes up, with and without
+the adaptive heartbeat and redundancy. A stand-in receiver on the loopback
+interface answers heartbeats and applies motor commands, while the
+controller side changes both motors' setpoints at a steady rate through the
+usual sendPacket()/updateLink()/linkRepeats() path with emulated loss.
+
+A setpoint counts as delivered if the receiver has applied it by the time the
+next one is commanded. The effective control bandwidth is the number of
+delivered setpoints per second.
+
+Each row is repeated and averaged, as one short run can be thrown a long way
+by a few unlucky losses. The lowest and highest delivered ratio of the
+repeats show the spread.
+
+Usage: linkbench [seconds per run] [setpoint interval ms] [repeats]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define MAX_REPEATS 100
+
+const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", "xbox", "ls", "rs", "up", "down", "left", "right"};
+
+volatile int receiverRunning = 1;
+volatile int applied[MAX_NUM_MOTORS]; // signed PWM values as the receiver sees them
+
+// Just enough of RobotReceiver to answer heartbeats and drive motors
+void *receiverThread(void *arg) {
+    nativeSocket *sock = (nativeSocket *)arg;
+    Uint8 buffer[PACKET_LENGTH], reply[12];
+    Uint32 nextpacket = 0;
+    while (receiverRunning) {
+        if (!nativeWait(sock, 10)) {
+            continue;
+        }
+        while (nativeRecv(sock, buffer, PACKET_LENGTH) >= 12) {
+            Uint32 packetID = SDLNet_Read32(buffer);
+            Uint32 command = SDLNet_Read32(buffer+4);
+            int argument = SDLNet_Read32(buffer+8);
+            if (command == 0) {
+                SDLNet_Write32(++nextpacket, reply);
+                SDLNet_Write32(1, reply+4);
+                SDLNet_Write32(packetID, reply+8);
+                nativeQueue(sock, reply, 12);
+            }
+            else if (command >= 10 && command % 10 >= 5 && command / 10 - 1 < MAX_NUM_MOTORS) {
+                int motor = command / 10 - 1;
+                applied[motor] = command % 10 == 5 ? argument : -argument;
+            }
+        }
+        nativeFlush(sock);
+    }
+    return NULL;
+}
+
+int expectedPWM(float value) {
+    return value > 0 ? (int)(MYPWMRANGE * value) : -(int)(MYPWMRANGE * -value);
+}
+
+typedef struct {
+    float packetRate;
+    float deliveredRate;
+    float ratio;
+    float estimatedLoss;
+    float rtt;
+    float interval;
+    float timeout;
+    float redundancy;
+} linkResult;
+
+void runLink(UDPremote *remote, float loss, int adaptive, int seconds, int setpointInterval, linkResult *result) {
+    static inputPipeline pipeline; // too big for the stack
+    robotState robotstate;
+    memset(&robotstate, 0, sizeof(robotstate));
+    robotstate.speed = 1;
+    robotstate.enabled = 1;
+    robotstate.numMotors = 2;
+    robotstate.pipeline = &pipeline;
+    initPipeline(&pipeline, 0, 2);
+
+    remote->emulatedLoss = loss;
+    remote->dropped = 0;
+    if (adaptive) {
+        initLink(&remote->link, HEARTBEAT_TIMEOUT/5, HEARTBEAT_TIMEOUT, 3);
+    }
+    else {
+        initLink(&remote->link, HEARTBEAT_TIMEOUT, HEARTBEAT_TIMEOUT, 0);
+    }
+
+    Uint32 startPackets = remote->nextpacket;
+    unsigned long start = SDL_GetTicks(), now = start, lastSetpoint = 0;
+    unsigned long commanded = 0, delivered = 0;
+    int expected[MAX_NUM_MOTORS] = {0};
+    while (now - start < (unsigned long)seconds * 1000) {
+        now = SDL_GetTicks();
+        if (now - remote->link.lastHeartbeat > remote->link.interval) {
+            sendHeartbeat(remote, 0, now);
+        }
+        updateLink(remote, now);
+
+        Uint32 packetID, command, argument;
+        while (receivePacket(remote, &packetID, &command, &argument) == 1) {
+            if (command == 1) {
+                linkReply(&remote->link, argument, now);
+            }
+        }
+
+        // a new setpoint, first checking whether the last one made it
+        if (now - lastSetpoint >= (unsigned long)setpointInterval) {
+            if (lastSetpoint != 0) {
+                commanded++;
+                delivered += applied[LEFT] == expected[LEFT] && applied[RIGHT] == expected[RIGHT];
+            }
+            lastSetpoint = now;
+            for (int i = 0; i < 2; i++) {
+                robotstate.axis[i] = (rand() % 201 - 100) / 100.0f;
+                expected[i] = expectedPWM(robotstate.axis[i]);
+            }
+        }
+
+        int changed = linkRepeats(&remote->link, updateOutputs(&pipeline, &robotstate, now), now);
+        for (int i = 0; i < 2; i++) {
+            if (changed & (1 << i)) {
+                updateMotor(remote, (i+1)*10, pipeline.output[i], 0, MYPWMRANGE, 1);
+            }
+        }
+        flushPackets(remote);
+        SDL_Delay(1);
+    }
+
+    float elapsed = (now - start) / 1000.0;
+    result->packetRate = (remote->nextpacket - startPackets) / elapsed;
+    result->deliveredRate = delivered / elapsed;
+    result->ratio = commanded ? 100.0 * delivered / commanded : 0;
+    result->estimatedLoss = remote->link.loss * 100;
+    result->rtt = remote->link.rtt;
+    result->interval = remote->link.interval;
+    result->timeout = remote->link.timeout;
+    result->redundancy = remote->link.redundancy;
+}
+
+// Average of the repeats, with the spread of the delivered ratio
+void printLink(float loss, int adaptive, const linkResult *results, int repeats) {
+    linkResult mean;
+    float lowest = results[0].ratio, highest = results[0].ratio;
+    memset(&mean, 0, sizeof(mean));
+    for (int i = 0; i < repeats; i++) {
+        mean.packetRate += results[i].packetRate / repeats;
+        mean.deliveredRate += results[i].deliveredRate / repeats;
+        mean.ratio += results[i].ratio / repeats;
+        mean.estimatedLoss += results[i].estimatedLoss / repeats;
+        mean.rtt += results[i].rtt / repeats;
+        mean.interval += results[i].interval / repeats;
+        mean.timeout += results[i].timeout / repeats;
+        mean.redundancy += results[i].redundancy / repeats;
+        if (results[i].ratio < lowest) lowest = results[i].ratio;
+        if (results[i].ratio > highest) highest = results[i].ratio;
+    }
+    printf("%5.0f%% %-8s %6.1f %8.1f %7.1f%% %5.1f-%5.1f%% %10.1f %9.1f %6.1f %9.0f %10.1f\n", loss * 100, adaptive ? "adaptive" : "fixed", \
+        mean.packetRate, mean.deliveredRate, mean.ratio, lowest, highest, \
+        mean.estimatedLoss, mean.rtt, mean.interval, mean.timeout, mean.redundancy);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 5, setpointInterval = 50, repeats = 4;
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        setpointInterval = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        repeats = atoi(argv[3]);
+    }
+    if (seconds <= 0 || setpointInterval <= 0 || repeats <= 0 || repeats > MAX_REPEATS) {
+        fprintf(stderr, "Usage: %s [seconds per run] [setpoint interval ms] [repeats, at most %i]\n", argv[0], MAX_REPEATS);
+        return 1;
+    }
+
+    if (SDL_Init(0) < 0 || SDLNet_Init() < 0) {
+        fprintf(stderr, "Couldn't initialise SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    // controller on an ephemeral port, receiver on another
+    UDPremote remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.udpsocket = SDLNet_UDP_Open(0);
+    remote.packet = SDLNet_AllocPacket(PACKET_LENGTH);
+    if (!remote.udpsocket || !remote.packet) {
+        fprintf(stderr, "SDLNet: %s\n", SDLNet_GetError());
+        return 1;
+    }
+    IPaddress controllerAddr;
+    SDLNet_ResolveHost(&controllerAddr, "127.0.0.1", 0);
+    controllerAddr.port = SDLNet_UDP_GetPeerAddress(remote.udpsocket, -1)->port;
+
+    nativeSocket receiver;
+    if (!nativeOpen(&receiver, &controllerAddr, 0, 0)) {
+        return 1;
+    }
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(receiver.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(receiver.fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        perror("bind");
+        return 1;
+    }
+    remote.remoteAddr.host = addr.sin_addr.s_addr;
+    remote.remoteAddr.port = addr.sin_port;
+    pthread_t receiverid;
+    pthread_create(&receiverid, NULL, receiverThread, &receiver);
+
+    printf("%i s per run, %i runs each, new setpoint every %i ms (%.1f/s)\n", seconds, repeats, setpointInterval, 1000.0 / setpointInterval);
+    printf(" loss mode      pkts/s delivered/s  ratio   lowest-highest est. loss  rtt (ms) hb (ms) timeout redundancy\n");
+    srand(1);
+    float losses[] = {0, 0.05, 0.1, 0.2, 0.3, 0.4};
+    linkResult results[MAX_REPEATS];
+    for (unsigned int i = 0; i < sizeof(losses) / sizeof(losses[0]); i++) {
+        for (int adaptive = 0; adaptive < 2; adaptive++) {
+            for (int j = 0; j < repeats; j++) {
+                runLink(&remote, losses[i], adaptive, seconds, setpointInterval, &results[j]);
+            }
+            printLink(losses[i], adaptive, results, repeats);
+        }
+    }
+
+    receiverRunning = 0;
+    pthread_join(receiverid, NULL);
+    nativeClose(&receiver);
+    SDLNet_FreePacket(remote.packet);
+    SDLNet_UDP_Close(remote.udpsocket);
+    SDLNet_Quit();
+    SDL_Quit();
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+/*
+
+macrobench
+
+Measure how accurately the macro engine fires steps while the control loop is
+busy with other things. A long synthetic macro is played through
+executeMacros() inside a loop that mirrors the one in robotcontroller.c, with
+optional background load:
+
+  -a N   push N joystick axis events per loop iteration
+  -s N   send stdout through a pipe that only drains N bytes per ms
+  -r N   send N extra packets per ms to the controller's socket
+
+  -c N   run N busy processes in the background to compete for the CPU
+
+Other options:
+
+  -n N   number of macro steps (default 5000)
+  -t A,B step spacing between A and B ms (default 1,10)
+  -R     real-time mode, as [runtime] realtime=1 (needs root or CAP_SYS_NICE)
+  -P N   SCHED_FIFO priority for real-time mode (default 50)
+  -C N   CPU to pin to in real-time mode (default none)
+  -S N   us to sleep each loop in real-time mode (default 100)
+
+For each step the lateness (when it was sent compared to when it should have
+been) is recorded, along with the gaps between loop iterations, which show
+scheduler preemption. Page faults and allocations during the run are counted. Statistics go to stderr, so that they aren't held up by a
+slow stdout.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define HISTOGRAM_BINS 16 // 1 ms bins, the last bin catches everything later
+#define GAP_BINS 8 // loop gaps, in powers of 10 us
+#define MAX_STRESS 64
+
+inputPipeline pipeline;
+const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", "xbox", "ls", "rs", "up", "down", "left", "right"};
+
+// Replace stdout with a pipe that a child process drains slowly, like a slow terminal
+pid_t slowStdout(int bytesPerMs) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char buffer[4096];
+        close(fds[1]);
+        int len = bytesPerMs < (int)sizeof(buffer) ? bytesPerMs : (int)sizeof(buffer);
+        while (read(fds[0], buffer, len) > 0) {
+            usleep(1000);
+        }
+        exit(0);
+    }
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    return pid;
+}
+
+// Busy processes for the scheduler to juggle us with
+void startStress(pid_t *pids, int count) {
+    for (int i = 0; i < count; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            volatile unsigned long spin = 0;
+            while (1) {
+                spin++;
+            }
+        }
+    }
+}
+
+double nowus() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+    int numSteps = 5000, minSpacing = 1, maxSpacing = 10;
+    int axisFlood = 0, stdoutRate = 0, recvRate = 0, stress = 0;
+    int realtime = 0, priority = DEFAULT_RT_PRIORITY, cpu = -1, sleep = DEFAULT_LOOP_SLEEP;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:a:s:r:c:RP:C:S:")) != -1) {
+        switch (opt) {
+            case 'n': numSteps = atoi(optarg); break;
+            case 't': sscanf(optarg, "%i,%i", &minSpacing, &maxSpacing); break;
+            case 'a': axisFlood = atoi(optarg); break;
+            case 's': stdoutRate = atoi(optarg); break;
+            case 'r': recvRate = atoi(optarg); break;
+            case 'c': stress = atoi(optarg); break;
+            case 'R': realtime = 1; break;
+            case 'P': priority = atoi(optarg); break;
+            case 'C': cpu = atoi(optarg); break;
+            case 'S': sleep = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n steps] [-t min,max] [-a axis events] [-s stdout bytes/ms] [-r packets/ms] [-c processes] [-R] [-P priority] [-C cpu] [-S sleep]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (stress > MAX_STRESS) {
+        stress = MAX_STRESS;
+    }
+    if (numSteps <= 0 || numSteps > MACRO_POOL_SIZE || minSpacing <= 0 || maxSpacing < minSpacing) {
+        fprintf(stderr, "Invalid macro settings\n");
+        return 1;
+    }
+
+    if (SDL_Init(SDL_INIT_EVENTS) < 0 || SDLNet_Init() < 0) {
+        fprintf(stderr, "Couldn't initialise SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    // the controller sends to itself, so its own packets are received as well
+    UDPremote remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.udpsocket = SDLNet_UDP_Open(0);
+    remote.packet = SDLNet_AllocPacket(PACKET_LENGTH);
+    if (!remote.udpsocket || !remote.packet) {
+        fprintf(stderr, "SDLNet: %s\n", SDLNet_GetError());
+        return 1;
+    }
+    SDLNet_ResolveHost(&remote.remoteAddr, "127.0.0.1", 0);
+    remote.remoteAddr.port = SDLNet_UDP_GetPeerAddress(remote.udpsocket, -1)->port;
+    nativeSocket traffic;
+    if (!nativeOpen(&traffic, &remote.remoteAddr, 0, 0)) {
+        return 1;
+    }
+
+    // synthetic macro on the first button
+    Macro macros[NUM_BUTTONS];
+    buttonDefinition buttons[NUM_BUTTONS];
+    buttonDefinition *allbuttons[NUM_BUTTONS];
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        macros[i].length = -1;
+        macros[i].running = 0;
+        buttons[i].value = "";
+        buttons[i].type = NONE;
+        buttons[i].macro = &macros[i];
+        allbuttons[i] = &buttons[i];
+    }
+    initPipeline(&pipeline, MAX_NUM_AXES, 2);
+    setMix(&pipeline, LEFT, 0, 1);
+    setMix(&pipeline, RIGHT, 1, 1);
+
+    Macro *macro = &macros[0];
+    buttons[0].value = "synthetic";
+    buttons[0].type = MACRO;
+    allocMacro(macro, numSteps);
+    srand(1);
+    for (int i = 0; i < numSteps; i++) {
+        macro->times[i] = minSpacing + rand() % (maxSpacing - minSpacing + 1);
+        if (i > 0) {
+            macro->times[i] += macro->times[i-1];
+        }
+        for (int j = 0; j < 2; j++) {
+            macro->velocities[j][i] = (rand() % 201 - 100) / 100.0f;
+        }
+    }
+
+    robotState robotstate;
+    robotstate.speed = 1;
+    robotstate.invert = 0;
+    robotstate.enabled = 1;
+    robotstate.numMotors = 2;
+    robotstate.macros = macros;
+    robotstate.pipeline = &pipeline;
+    robotstate.joystick = NULL;
+    robotstate.recording = NULL;
+    for (int i = 0; i < MAX_NUM_MOTORS; i++) {
+        robotstate.axis[i] = 0;
+    }
+
+    fprintf(stderr, "%i steps %i-%i ms apart, %lu ms long\n", numSteps, minSpacing, maxSpacing, macro->times[numSteps-1]);
+    fprintf(stderr, "Load: %i axis events/loop, stdout %i bytes/ms, %i extra packets/ms, %i busy processes\n", axisFlood, stdoutRate, recvRate, stress);
+
+    pid_t child = 0;
+    if (stdoutRate > 0) {
+        child = slowStdout(stdoutRate);
+    }
+
+    long *lateness = (long *)malloc(sizeof(long) * numSteps);
+    unsigned long histogram[HISTOGRAM_BINS] = {0};
+    unsigned long gaps[GAP_BINS] = {0};
+    double maxGap = 0;
+
+    pid_t stressPids[MAX_STRESS];
+    startStress(stressPids, stress); // before going real-time, so they don't inherit it
+    if (realtime) {
+        fprintf(stderr, "Real-time mode, SCHED_FIFO priority %i, CPU %i\n", priority, cpu);
+        if (!enableRealtime(priority, cpu, 1)) {
+            fprintf(stderr, "Couldn't fully enable real-time mode, continuing anyway\n");
+        }
+    }
+    unsigned long loops = 0, lastTraffic;
+    Uint8 junk[12] = {0};
+    SDL_Event event;
+
+    SDL_Delay(10); // a running time of 0 means stopped, so make sure we're past it
+    unsigned long started = SDL_GetTicks();
+    macro->running = started;
+    macro->at = 0;
+    lastTraffic = started;
+    startRealtimeCheck();
+    double lastLoop = nowus();
+    while (macro->running > 0) {
+        loops++;
+        double loopStart = nowus();
+        double gap = loopStart - lastLoop;
+        lastLoop = loopStart;
+        if (gap > maxGap) {
+            maxGap = gap;
+        }
+        int bin = 0;
+        while (gap >= 10 && bin < GAP_BINS - 1) {
+            gap /= 10;
+            bin++;
+        }
+        gaps[bin]++;
+
+        // background load
+        unsigned long now = SDL_GetTicks();
+        if (recvRate > 0 && now != lastTraffic) {
+            for (unsigned long i = 0; i < (now - lastTraffic) * recvRate; i++) {
+                nativeQueue(&traffic, junk, 12);
+            }
+            nativeFlush(&traffic);
+            lastTraffic = now;
+        }
+        for (int i = 0; i < axisFlood; i++) {
+            event.type = SDL_JOYAXISMOTION;
+            event.jaxis.axis = 3; // not mapped to a motor, so the macro isn't disturbed
+            event.jaxis.value = rand() % 65536 - 32768;
+            SDL_PushEvent(&event);
+        }
+
+        // the rest is as in the real control loop
+        Uint32 packetID, command, argument;
+        while (receivePacket(&remote, &packetID, &command, &argument) == 1) {
+            printTime();
+            printf("Packet recieved...\n");
+        }
+
+        while (SDL_PollEvent(&event) != 0) {
+            if (event.type == SDL_JOYAXISMOTION) {
+                setPipelineInput(&pipeline, event.jaxis.axis, event.jaxis.value);
+            }
+        }
+        mixPipeline(&pipeline, robotstate.axis);
+
+        int at = macro->at;
+        now = SDL_GetTicks();
+        executeMacros(&robotstate, allbuttons, now);
+        if (macro->at != at) {
+            long late = (long)(now - macro->running) - (at == 0 ? 0 : (long)macro->times[at-1]);
+            lateness[at] = late;
+            histogram[late < HISTOGRAM_BINS - 1 ? (late < 0 ? 0 : late) : HISTOGRAM_BINS - 1]++;
+        }
+
+        int changed = updateOutputs(&pipeline, &robotstate, now);
+        for (int i = 0; i < robotstate.numMotors; i++) {
+            if (changed & (1 << i)) {
+                updateMotor(&remote, (i+1)*10, pipeline.output[i], 0, MYPWMRANGE, 1);
+            }
+        }
+        flushPackets(&remote);
+        if (realtime) {
+            loopSleep(sleep);
+        }
+    }
+    unsigned long finished = SDL_GetTicks();
+    long faults, allocations;
+    realtimeCheck(&faults, &allocations);
+    for (int i = 0; i < stress; i++) {
+        kill(stressPids[i], SIGKILL);
+        waitpid(stressPids[i], NULL, 0);
+    }
+
+    fflush(stdout);
+    if (child > 0) {
+        fclose(stdout);
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+    }
+
+    int fired = macro->at;
+    long total = 0, worst = 0;
+    for (int i = 0; i < fired; i++) {
+        total += lateness[i];
+        if (lateness[i] > worst) {
+            worst = lateness[i];
+        }
+    }
+
+    fprintf(stderr, "\n%lu loop iterations\n", loops);
+    fprintf(stderr, "%i/%i steps sent, %i skipped\n", fired, numSteps, numSteps - fired);
+    if (fired > 0) {
+        fprintf(stderr, "Lateness: mean %.2f ms, max %li ms, last step %li ms\n", (double)total / fired, worst, lateness[fired-1]);
+    }
+    // a skipped step ends the macro early, so drift is negative if steps were skipped
+    fprintf(stderr, "Drift: macro ended %li ms after it should have\n", (long)(finished - started) - (long)macro->times[numSteps-1]);
+    fprintf(stderr, "Longest gap between loop iterations %.0f us\n", maxGap);
+    fprintf(stderr, "Loop gap histogram (us: loops)\n");
+    for (int i = 0, limit = 10; i < GAP_BINS; i++, limit *= 10) {
+        fprintf(stderr, "  %s%8i: %lu\n", i == GAP_BINS - 1 ? ">=" : " <", i == GAP_BINS - 1 ? limit / 10 : limit, gaps[i]);
+    }
+    fprintf(stderr, "%li page faults and %li allocations during the run\n", faults, allocations);
+    fprintf(stderr, "Lateness histogram (ms: steps)\n");
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        fprintf(stderr, "  %s%2i: %lu\n", i == HISTOGRAM_BINS - 1 ? ">=" : "  ", i, histogram[i]);
+    }
+
+    nativeClose(&traffic);
+    SDLNet_FreePacket(remote.packet);
+    SDLNet_UDP_Close(remote.udpsocket);
+    SDLNet_Quit();
+    SDL_Quit();
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+#ifdef __linux__
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE // for sendmmsg/recvmmsg, normally set by the Makefile
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/ip.h>
+
+#include "../robot.h"
+#include "nativeudp.h"
+
+int nativeOpen(nativeSocket *sock, const IPaddress *remoteAddr, int dscp, int priority) {
+    memset(sock, 0, sizeof(nativeSocket));
+    sock->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock->fd < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return 0;
+    }
+
+    // SDLNet_ResolveHost already gives us network byte order
+    sock->addr.sin_family = AF_INET;
+    sock->addr.sin_addr.s_addr = remoteAddr->host;
+    sock->addr.sin_port = remoteAddr->port;
+
+    // mark packets so that the access point puts them in the voice queue,
+    // failure here isn't fatal, the packets just go out as best effort
+    int tos = (dscp & 0x3f) << 2;
+    if (setsockopt(sock->fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+        fprintf(stderr, "setsockopt IP_TOS %i: %s\n", tos, strerror(errno));
+    }
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) < 0) {
+        fprintf(stderr, "setsockopt SO_PRIORITY %i: %s\n", priority, strerror(errno));
+    }
+
+    // everything goes to the same place, so the message headers only need setting up once
+    for (int i = 0; i < NATIVE_SEND_BATCH; i++) {
+        sock->outiov[i].iov_base = sock->outbuf[i];
+        sock->outmsgs[i].msg_hdr.msg_name = &sock->addr;
+        sock->outmsgs[i].msg_hdr.msg_namelen = sizeof(sock->addr);
+        sock->outmsgs[i].msg_hdr.msg_iov = &sock->outiov[i];
+        sock->outmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int i = 0; i < NATIVE_RECV_BATCH; i++) {
+        sock->iniov[i].iov_base = sock->inbuf[i];
+        sock->iniov[i].iov_len = PACKET_LENGTH;
+        sock->inmsgs[i].msg_hdr.msg_iov = &sock->iniov[i];
+        sock->inmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return 1;
+}
+
+void nativeClose(nativeSocket *sock) {
+    if (sock->fd >= 0) {
+        nativeFlush(sock);
+        close(sock->fd);
+    }
+    sock->fd = -1;
+}
+
+// Add a packet to the outbound queue, sending the queue if it is full
+int nativeQueue(nativeSocket *sock, const Uint8 *data, int len) {
+    if (len > PACKET_LENGTH) {
+        len = PACKET_LENGTH;
+    }
+    if (sock->queued == NATIVE_SEND_BATCH) {
+        nativeFlush(sock);
+    }
+    memcpy(sock->outbuf[sock->queued], data, len);
+    sock->outiov[sock->queued].iov_len = len;
+    sock->queued++;
+    return len;
+}
+
+// Send everything waiting in the outbound queue, returns the number of packets sent
+int nativeFlush(nativeSocket *sock) {
+    int sent = 0;
+    while (sent < sock->queued) {
+        int ret = sendmmsg(sock->fd, &sock->outmsgs[sent], sock->queued - sent, 0);
+        sock->syscalls++;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN means the socket buffer is full, drop the rest rather than block
+            if (errno != EAGAIN && errno != ECONNREFUSED) {
+                fprintf(stderr, "sendmmsg: %s\n", strerror(errno));
+            }
+            break;
+        }
+        sent += ret;
+    }
+    sock->queued = 0;
+    return sent;
+}
+
+// Copy out the next waiting packet, returns its length or 0 if there are none
+int nativeRecv(nativeSocket *sock, Uint8 *data, int maxlen) {
+    if (sock->at == sock->received) {
+        sock->at = 0;
+        sock->received = recvmmsg(sock->fd, sock->inmsgs, NATIVE_RECV_BATCH, MSG_DONTWAIT, NULL);
+        sock->syscalls++;
+        if (sock->received <= 0) {
+            sock->received = 0;
+            return 0;
+        }
+    }
+
+    int len = sock->inmsgs[sock->at].msg_len;
+    if (len > maxlen) {
+        len = maxlen;
+    }
+    memcpy(data, sock->inbuf[sock->at], len);
+    sock->at++;
+    return len;
+}
+
+// Wait up to timeout ms for a packet to arrive, returns 1 if one is waiting
+int nativeWait(nativeSocket *sock, int timeout) {
+    return nativeWaitAny(&sock, 1, timeout);
+}
+
+// Wait up to timeout ms for a packet to arrive on any of the sockets, so that
+// a loop can sleep until there's something to read, returns 1 if one is waiting
+int nativeWaitAny(nativeSocket **socks, int count, int timeout) {
+    struct pollfd pfds[NATIVE_WAIT_MAX];
+    if (count > NATIVE_WAIT_MAX) {
+        count = NATIVE_WAIT_MAX;
+    }
+    for (int i = 0; i < count; i++) {
+        if (socks[i]->at < socks[i]->received) {
+            return 1; // already read in, but not handed out yet
+        }
+        pfds[i].fd = socks[i]->fd;
+        pfds[i].events = POLLIN;
+    }
+    return poll(pfds, count, timeout) > 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,53 @@
+#ifndef _NATIVEUDP_H_
+#define _NATIVEUDP_H_ 1
+
+/* Linux-only UDP backend built directly on non-blocking sockets, as an
+ * alternative to SDL_net. Outgoing packets are queued and sent in batches with
+ * sendmmsg(), incoming packets are drained in batches with recvmmsg(). */
+
+#ifdef __linux__
+
+#include <SDL2/SDL_net.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../robot.h"
+
+#define NATIVE_SEND_BATCH 32 // packets queued before a send is forced
+#define NATIVE_RECV_BATCH 16 // packets read per recvmmsg() call
+#define NATIVE_WAIT_MAX 16 // sockets nativeWaitAny() can wait on at once
+
+#define DEFAULT_DSCP 46 // expedited forwarding, maps to the WMM voice queue
+#define DEFAULT_SO_PRIORITY 6 // 6 and 7 are mapped to the voice access category
+
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;
+
+    // outbound queue
+    struct mmsghdr outmsgs[NATIVE_SEND_BATCH];
+    struct iovec outiov[NATIVE_SEND_BATCH];
+    Uint8 outbuf[NATIVE_SEND_BATCH][PACKET_LENGTH];
+    int queued;
+
+    // inbound batch, handed out one packet at a time
+    struct mmsghdr inmsgs[NATIVE_RECV_BATCH];
+    struct iovec iniov[NATIVE_RECV_BATCH];
+    Uint8 inbuf[NATIVE_RECV_BATCH][PACKET_LENGTH];
+    int received;
+    int at;
+
+    unsigned long syscalls; // number of send/recv system calls made, for benchmarking
+} nativeSocket;
+
+int nativeOpen(nativeSocket *sock, const IPaddress *remoteAddr, int dscp, int priority);
+void nativeClose(nativeSocket *sock);
+int nativeQueue(nativeSocket *sock, const Uint8 *data, int len);
+int nativeFlush(nativeSocket *sock);
+int nativeRecv(nativeSocket *sock, Uint8 *data, int maxlen);
+int nativeWait(nativeSocket *sock, int timeout);
+int nativeWaitAny(nativeSocket **socks, int count, int timeout);
+
+#endif /* __linux__ */
+
+#endif /* _NATIVEUDP_H_ */
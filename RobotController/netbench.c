@@ -0,0 +1,160 @@
+/*
+
+netbench
+
+Compare the SDL_net and native socket backends for sending control packets.
+Packets are sent in bursts the size of a typical control loop tick to a sink
+socket on the loopback interface, reporting send system calls and per-tick
+send latency for each backend.
+
+Usage: netbench [ticks] [packets per tick]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define DEFAULT_TICKS 100000
+#define DEFAULT_BURST 4 // two motors, forwards and reverse
+
+const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", "xbox", "ls", "rs", "up", "down", "left", "right"};
+
+volatile int sinkRunning = 1;
+unsigned long sinkReceived = 0;
+
+double nowus() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Drain everything sent to the sink so that the socket buffer never fills
+void *sinkThread(void *arg) {
+    nativeSocket *sink = (nativeSocket *)arg;
+    Uint8 buffer[PACKET_LENGTH];
+    while (sinkRunning) {
+        if (nativeWait(sink, 10)) {
+            while (nativeRecv(sink, buffer, PACKET_LENGTH) > 0) {
+                sinkReceived++;
+            }
+        }
+    }
+    return NULL;
+}
+
+int comparedouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void runBench(const char *name, UDPremote *remote, int ticks, int burst, double *latencies) {
+    unsigned long startReceived = sinkReceived;
+    unsigned long startSyscalls = remote->native.syscalls;
+    double start = nowus();
+    for (int i = 0; i < ticks; i++) {
+        double t0 = nowus();
+        for (int j = 0; j < burst; j++) {
+            sendPacket(remote, 15 + (j % 2), j);
+        }
+        flushPackets(remote);
+        latencies[i] = nowus() - t0;
+    }
+    double elapsed = (nowus() - start) / 1e6;
+    usleep(100000); // let the sink catch up
+
+    unsigned long packets = (unsigned long)ticks * burst;
+    // SDL_net makes one sendto() per packet, native counts its own
+    unsigned long syscalls = remote->useNative ? remote->native.syscalls - startSyscalls : packets;
+    qsort(latencies, ticks, sizeof(double), comparedouble);
+    double mean = 0;
+    for (int i = 0; i < ticks; i++) {
+        mean += latencies[i];
+    }
+    mean /= ticks;
+
+    printf("%-7s %9lu packets in %.3f s, %.0f packets/s, %lu received\n", name, packets, elapsed, packets / elapsed, sinkReceived - startReceived);
+    printf("%-7s %9lu send syscalls, %.0f syscalls/s, %.3f per packet\n", "", syscalls, syscalls / elapsed, (double)syscalls / packets);
+    printf("%-7s tick latency us: mean %.2f, p50 %.2f, p99 %.2f, max %.2f\n", "", mean, latencies[ticks/2], latencies[(int)(ticks*0.99)], latencies[ticks-1]);
+}
+
+int main(int argc, char **argv) {
+    int ticks = DEFAULT_TICKS, burst = DEFAULT_BURST;
+    if (argc > 1) {
+        ticks = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        burst = atoi(argv[2]);
+    }
+    if (ticks <= 0 || burst <= 0) {
+        fprintf(stderr, "Usage: %s [ticks] [packets per tick]\n", argv[0]);
+        return 1;
+    }
+
+    if (SDLNet_Init() < 0) {
+        fprintf(stderr, "Couldn't initialise SDLNet: %s\n", SDLNet_GetError());
+        return 1;
+    }
+
+    // sink on an ephemeral loopback port
+    IPaddress loopback;
+    SDLNet_ResolveHost(&loopback, "127.0.0.1", 0);
+    nativeSocket sink;
+    if (!nativeOpen(&sink, &loopback, 0, 0)) {
+        return 1;
+    }
+    struct sockaddr_in sinkaddr;
+    socklen_t addrlen = sizeof(sinkaddr);
+    memset(&sinkaddr, 0, sizeof(sinkaddr));
+    sinkaddr.sin_family = AF_INET;
+    sinkaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sink.fd, (struct sockaddr *)&sinkaddr, sizeof(sinkaddr)) < 0 || getsockname(sink.fd, (struct sockaddr *)&sinkaddr, &addrlen) < 0) {
+        perror("bind");
+        return 1;
+    }
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sink.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    pthread_t sinkid;
+    pthread_create(&sinkid, NULL, sinkThread, &sink);
+
+    UDPremote remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.remoteAddr.host = sinkaddr.sin_addr.s_addr;
+    remote.remoteAddr.port = sinkaddr.sin_port;
+
+    double *latencies = (double *)malloc(sizeof(double) * ticks);
+    printf("%i ticks of %i packets to 127.0.0.1:%i\n", ticks, burst, ntohs(sinkaddr.sin_port));
+
+    remote.udpsocket = SDLNet_UDP_Open(0);
+    remote.packet = SDLNet_AllocPacket(PACKET_LENGTH);
+    if (!remote.udpsocket || !remote.packet) {
+        fprintf(stderr, "SDLNet: %s\n", SDLNet_GetError());
+        return 1;
+    }
+    runBench("sdl_net", &remote, ticks, burst, latencies);
+
+    if (!nativeOpen(&remote.native, &remote.remoteAddr, DEFAULT_DSCP, DEFAULT_SO_PRIORITY)) {
+        return 1;
+    }
+    remote.useNative = 1;
+    runBench("native", &remote, ticks, burst, latencies);
+
+    sinkRunning = 0;
+    pthread_join(sinkid, NULL);
+    nativeClose(&remote.native);
+    nativeClose(&sink);
+    SDLNet_FreePacket(remote.packet);
+    SDLNet_UDP_Close(remote.udpsocket);
+    SDLNet_Quit();
+    free(latencies);
+
+    return 0;
+}
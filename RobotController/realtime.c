@@ -0,0 +1,188 @@
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+
+#include "realtime.h"
+
+#if defined(REALTIME_CHECK) && defined(__GLIBC__)
+    #define COUNT_ALLOCATIONS 1
+#else
+    #define COUNT_ALLOCATIONS 0
+#endif
+
+long faultsAtStart = 0;
+long lastFaults = 0;
+long allocations = 0; // allocations since startRealtimeCheck(), only changed atomically
+int countAllocations = 0;
+long lastAllocations = 0;
+
+#if COUNT_ALLOCATIONS
+// Count allocations by wrapping glibc's allocator, this catches SDL and GLib
+// allocating on our behalf as well as our own code. Only built into the check
+// build and the benchmarks, it's not something to ship.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+static void countAllocation() {
+    if (__atomic_load_n(&countAllocations, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED); // SDL and GLib have threads of their own
+    }
+}
+
+void *malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    countAllocation();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    countAllocation();
+    void *mem = __libc_memalign(alignment, size);
+    if (mem == NULL) {
+        return ENOMEM;
+    }
+    *ptr = mem;
+    return 0;
+}
+
+void *valloc(size_t size) {
+    countAllocation();
+    return __libc_valloc(size);
+}
+
+void *pvalloc(size_t size) {
+    countAllocation();
+    return __libc_pvalloc(size);
+}
+
+// wrapped too so that everything goes to the one allocator, whatever glibc does with the others
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+#endif
+
+// Touch the stack now, so that growing into it later doesn't page fault. Written
+// through the volatile array a byte a page, as a memset() of it can be optimised away
+void prefaultStack() {
+    volatile char stack[PREFAULT_STACK_SIZE];
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0) {
+        pagesize = 4096;
+    }
+    for (long i = 0; i < PREFAULT_STACK_SIZE; i += pagesize) {
+        stack[i] = 0;
+    }
+    (void)stack;
+}
+
+// Returns 1 if everything asked for was set up, failures are reported but not fatal
+int enableRealtime(int priority, int cpu, int lockMemory) {
+    int ok = 1;
+
+    if (lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            fprintf(stderr, "mlockall: %s\n", strerror(errno));
+            ok = 0;
+        }
+        prefaultStack();
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "sched_setaffinity %i: %s\n", cpu, strerror(errno));
+            ok = 0;
+        }
+    }
+
+    if (priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            fprintf(stderr, "sched_setscheduler SCHED_FIFO %i: %s (needs root or CAP_SYS_NICE)\n", priority, strerror(errno));
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
+
+// Give the rest of the system a look in, otherwise once real-time tasks have
+// used sched_rt_runtime_us of each second the kernel stops us for the remainder
+void loopSleep(long us) {
+    if (us > 0) {
+        struct timespec ts;
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (us % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+    }
+}
+
+long pageFaults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// Call once everything has been set up, from then on faults and allocations are counted
+void startRealtimeCheck() {
+    faultsAtStart = pageFaults();
+    lastFaults = 0;
+    __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+    lastAllocations = COUNT_ALLOCATIONS ? 0 : -1;
+    __atomic_store_n(&countAllocations, 1, __ATOMIC_RELAXED);
+}
+
+// Get the page faults and allocations since startRealtimeCheck(), returns 1 if
+// there are new ones. Allocations are -1 unless built with REALTIME_CHECK.
+int realtimeCheck(long *faults, long *allocs) {
+    *faults = pageFaults() - faultsAtStart;
+    *allocs = COUNT_ALLOCATIONS ? __atomic_load_n(&allocations, __ATOMIC_RELAXED) : -1;
+    int changed = *faults != lastFaults || *allocs != lastAllocations;
+    lastFaults = *faults;
+    lastAllocations = *allocs;
+    return changed;
+}
+
+#endif /* __linux__ */
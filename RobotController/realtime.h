@@ -0,0 +1,22 @@
+#ifndef _REALTIME_H_
+#define _REALTIME_H_ 1
+
+/* Optional real-time operation for the controller under Linux: SCHED_FIFO,
+ * CPU affinity and locked memory, plus a check that nothing page faults or
+ * allocates once the control loop is running. */
+
+#ifdef __linux__
+
+#define DEFAULT_RT_PRIORITY 50
+#define REALTIME_CHECK_INTERVAL 10000 // ms between checks for page faults and allocations
+#define DEFAULT_LOOP_SLEEP 100 // us slept each loop, a SCHED_FIFO busy loop gets throttled by the kernel
+#define PREFAULT_STACK_SIZE (256*1024) // bytes of stack touched before locking memory
+
+int enableRealtime(int priority, int cpu, int lockMemory);
+void startRealtimeCheck();
+int realtimeCheck(long *faults, long *allocations);
+void loopSleep(long us);
+
+#endif /* __linux__ */
+
+#endif /* _REALTIME_H_ */
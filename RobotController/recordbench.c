@@ -0,0 +1,241 @@
+/*
+
+recordbench
+
+Check that a recorded macro plays back what was driven. A minute of synthetic
+driving (stops, ramps, a steady hold with a little noise, a sine, a slow
+coast down to a stop and one motor turning on its own) is fed through
+startRecording()/recordSample()/finishRecording() with the loop taking 1 to 3
+ms each time round, like a busy control loop. The resulting macro is checked
+against the samples it was made from:
+
+  every sample is within max_error of the step that covers it
+  a motor that was stopped (exactly 0) is exactly 0 in its step
+  step end times increase, each is a sample's time, and the last is the end
+  writing the macro with saveRecording() and reading it back with readMacro()
+  gives the same times, the same zeros and the same values to 1e-5
+
+The number of steps and the largest error are printed for each max_error.
+Results go to stderr, stdout only has what finishRecording() prints. Exits
+with 1 if any check fails.
+
+Usage: recordbench [seconds] [interval ms]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define NUM_MOTORS 2
+
+const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", "xbox", "ls", "rs", "up", "down", "left", "right"};
+
+extern int macroPoolUsed; // the pool is never freed, each run starts with it empty
+
+Recording recording; // too big for the stack
+unsigned long sampleTimes[RECORD_LENGTH];
+float samples[NUM_MOTORS][RECORD_LENGTH];
+
+// Same every run, so that a failure can be reproduced
+unsigned int seed = 1;
+int nextRandom(int range) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % range;
+}
+
+// What the driver is doing t ms in, in a 12 s pattern
+void drive(unsigned long t, float *axis) {
+    float s = (t % 12000) / 1000.0f;
+    float noise = (nextRandom(1001) - 500) / 100000.0f; // +-0.005
+    if (s < 1) { // stopped
+        axis[0] = axis[1] = 0;
+    }
+    else if (s < 3) { // ramp up
+        axis[0] = (s - 1) / 2;
+        axis[1] = -0.8f * (s - 1) / 2;
+    }
+    else if (s < 5) { // hold
+        axis[0] = 1 - 0.005f + noise;
+        axis[1] = -0.8f + noise;
+    }
+    else if (s < 8) { // weave
+        axis[0] = 0.5f + 0.5f * sinf((s - 5) * 3);
+        axis[1] = -0.5f * sinf((s - 5) * 2);
+    }
+    else if (s < 10) { // coast down, getting very close to 0 before stopping
+        axis[0] = 0.4f * powf((10 - s) / 2, 4);
+        axis[1] = -0.3f * powf((10 - s) / 2, 4);
+        if (s > 9.9f) {
+            axis[0] = axis[1] = 0;
+        }
+    }
+    else if (s < 11) { // stopped
+        axis[0] = axis[1] = 0;
+    }
+    else { // turn on the spot with one motor
+        axis[0] = 0;
+        axis[1] = -0.6f;
+    }
+}
+
+// Record, simplify and check against the samples, returns the number of failed checks
+int runCheck(unsigned long duration, unsigned long interval, float maxError) {
+    robotState robotstate;
+    Macro macro, readback;
+    buttonDefinition target;
+    int failures = 0;
+    int i, j, k;
+
+    memset(&robotstate, 0, sizeof(robotstate));
+    memset(&macro, 0, sizeof(macro));
+    memset(&readback, 0, sizeof(readback));
+    memset(&target, 0, sizeof(target));
+    target.type = NONE;
+    target.macro = &macro;
+    recording.target = &target;
+    recording.interval = interval;
+    recording.maxError = maxError;
+    recording.unsaved = 0;
+    strcpy(recording.file, "/tmp/recordbench-XXXXXX");
+    int fd = mkstemp(recording.file);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    close(fd);
+    robotstate.recording = &recording;
+    robotstate.numMotors = NUM_MOTORS;
+    macroPoolUsed = 0;
+
+    // the loop, taking a sample whenever one is due
+    seed = 1;
+    unsigned long started = 1000;
+    unsigned long now = started;
+    startRecording(&recording, now);
+    while (now - started < duration) {
+        drive(now - started, robotstate.axis);
+        recordSample(&robotstate, now);
+        now += 1 + nextRandom(3);
+    }
+    int length = recording.length;
+    memcpy(sampleTimes, recording.times, length * sizeof(sampleTimes[0]));
+    for (j = 0; j < NUM_MOTORS; j++) {
+        memcpy(samples[j], recording.samples[j], length * sizeof(samples[j][0]));
+    }
+    if (finishRecording(&robotstate, started + duration) == 0) {
+        fprintf(stderr, "max_error %g: finishRecording() failed\n", maxError);
+        return 1;
+    }
+
+    // step end times
+    for (k = 0; k < macro.length; k++) {
+        if (k > 0 && macro.times[k] <= macro.times[k-1]) {
+            fprintf(stderr, "max_error %g: step %i ends at %lu, not after step %i at %lu\n", maxError, k, macro.times[k], k-1, macro.times[k-1]);
+            failures++;
+        }
+    }
+    if (macro.times[macro.length-1] != duration) {
+        fprintf(stderr, "max_error %g: last step ends at %lu, not %lu\n", maxError, macro.times[macro.length-1], duration);
+        failures++;
+    }
+
+    // each sample against the step covering it
+    float worst = 0;
+    for (i = 0, k = 0; i < length; i++) {
+        int from = k;
+        while (k < macro.length && macro.times[k] <= sampleTimes[i]) {
+            k++;
+        }
+        if (k > from + 1) {
+            fprintf(stderr, "max_error %g: step %i has no samples in it\n", maxError, from);
+            failures++;
+        }
+        if (k == macro.length) {
+            fprintf(stderr, "max_error %g: sample %i at %lu is after the last step\n", maxError, i, sampleTimes[i]);
+            failures++;
+            break;
+        }
+        if (k > 0 && (i == 0 || sampleTimes[i-1] < macro.times[k-1]) && sampleTimes[i] != macro.times[k-1]) {
+            fprintf(stderr, "max_error %g: step %i ends at %lu, which isn't a sample's time\n", maxError, k-1, macro.times[k-1]);
+            failures++;
+        }
+        for (j = 0; j < NUM_MOTORS; j++) {
+            float error = fabsf(samples[j][i] - macro.velocities[j][k]);
+            if (error > worst) worst = error;
+            if (error > maxError + 1e-6f) {
+                fprintf(stderr, "max_error %g: motor %i is %f at %lu ms but step %i is %f\n", maxError, j, samples[j][i], sampleTimes[i], k, macro.velocities[j][k]);
+                failures++;
+            }
+            if (samples[j][i] == 0 && macro.velocities[j][k] != 0) {
+                fprintf(stderr, "max_error %g: motor %i is stopped at %lu ms but step %i is %g\n", maxError, j, sampleTimes[i], k, macro.velocities[j][k]);
+                failures++;
+            }
+        }
+    }
+
+    // round trip through the file
+    if (saveRecording(&recording, NUM_MOTORS) == 0 || readMacro(recording.file, &readback, NUM_MOTORS) == 0) {
+        fprintf(stderr, "max_error %g: couldn't write and read back %s\n", maxError, recording.file);
+        failures++;
+    }
+    else if (readback.length != macro.length) {
+        fprintf(stderr, "max_error %g: %i steps written, %i read back\n", maxError, macro.length, readback.length);
+        failures++;
+    }
+    else {
+        for (k = 0; k < macro.length; k++) {
+            if (readback.times[k] != macro.times[k]) {
+                fprintf(stderr, "max_error %g: step %i ends at %lu, read back as %lu\n", maxError, k, macro.times[k], readback.times[k]);
+                failures++;
+            }
+            for (j = 0; j < NUM_MOTORS; j++) {
+                float written = macro.velocities[j][k], read = readback.velocities[j][k];
+                if (fabsf(written - read) > 1e-5f || (written == 0) != (read == 0)) {
+                    fprintf(stderr, "max_error %g: motor %i in step %i is %g, read back as %g\n", maxError, j, k, written, read);
+                    failures++;
+                }
+            }
+        }
+    }
+    unlink(recording.file);
+
+    fprintf(stderr, "max_error %-6g %6i samples -> %5i steps (%5.1f:1), worst error %f, %s\n", \
+        maxError, length, macro.length, (float)length / macro.length, worst, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long duration = 60000;
+    unsigned long interval = RECORD_INTERVAL;
+    float errors[] = {0, 0.005, RECORD_MAX_ERROR, 0.05, 0.2};
+    int failures = 0;
+
+    if (argc > 1) {
+        duration = atoi(argv[1]) * 1000UL;
+    }
+    if (argc > 2) {
+        interval = atoi(argv[2]);
+    }
+    // the macro and what's read back both have to fit in the pool
+    if (duration == 0 || interval == 0 || duration / interval >= MACRO_POOL_SIZE / 2) {
+        fprintf(stderr, "Usage: %s [seconds] [interval ms], at most %i samples\n", argv[0], MACRO_POOL_SIZE / 2 - 1);
+        return 1;
+    }
+
+    fprintf(stderr, "Recording %lu s, a sample every %lu ms\n", duration / 1000, interval);
+    for (unsigned int i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        failures += runCheck(duration, interval, errors[i]);
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%i checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
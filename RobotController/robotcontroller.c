@@ -16,6 +16,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef __WIN32__
     #define SDL_MAIN_HANDLED
     #include <windows.h>
@@ -30,10 +31,12 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include "../robot.h"
 #include "robotcontroller.h"
 #include "controllerfunctions.h"
+#include "bindings.h"
 
 
-SDL_Joystick *joystick;
-UDPremote remote;
+robotBinding *bindings = NULL; // too big for the stack
+int numBindings = 0;
+SDLNet_SocketSet sockets = NULL; // SDL_net sockets to wait on for replies
 const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", 
 #ifndef __WIN32__
     "xbox", 
@@ -42,17 +45,15 @@ const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu",
 
 void cleanup() {
     printf("Exiting...\n");
-    if (remote.packet && remote.udpsocket)
-        sendPacket(&remote, 255, 0); // make sure the motors are stopped before we go
-    if (remote.packet)
-        SDLNet_FreePacket(remote.packet);
-    remote.packet = NULL;
-    if (remote.udpsocket)
-        SDLNet_UDP_Close(remote.udpsocket);
-    remote.udpsocket = NULL;
-    if (joystick)
-        SDL_JoystickClose(joystick);
-    joystick = NULL;
+    for (int i = 0; i < numBindings; i++) {
+        closeBinding(&bindings[i]);
+    }
+    free(bindings);
+    bindings = NULL;
+    numBindings = 0;
+    if (sockets != NULL)
+        SDLNet_FreeSocketSet(sockets);
+    sockets = NULL;
     SDLNet_Quit();
     SDL_Quit();
     exit(0);
@@ -60,21 +61,8 @@ void cleanup() {
 
 
 int main(){ //int argc, char **argv) {
-    int i, j, k;
+    int i;
     unsigned long now;
-    int axismap[MAX_NUM_MOTORS];
-    robotState robotstate;
-    robotstate.speed = 1; // fast
-    robotstate.invert = 0;
-    robotstate.enabled = 0;
-    robotstate.numMotors = 0; // this will be overwritten later
-    for (i = 0; i < MAX_NUM_MOTORS; i++) {
-        robotstate.axis[i] = 0;
-        axismap[i] = -1;
-    }
-    robotstate.axismap = axismap;
-    robotState laststate;
-    copystate(&robotstate, &laststate);
 
     // Handle internal quits nicely
     atexit(cleanup);
@@ -107,8 +95,8 @@ int main(){ //int argc, char **argv) {
         printf("    (%i) %s\n", i, SDL_JoystickNameForIndex(i));
     }
 
-    // load which joystick from file
-    int joystickID = 0;
+    // load which robots to control from file
+    char bindingnames[STRING_BUFFER_LENGTH*4];
 #ifdef  __linux__
     GKeyFile* gkf = g_key_file_new();
     GError *gerror = NULL;
@@ -118,428 +106,229 @@ int main(){ //int argc, char **argv) {
         gerror = NULL;
         exit(2);
     }
+    configFile config = gkf;
 
-    joystickID = getIntFromConfig(gkf, "controller", "id", 0);
+    snprintf(bindingnames, sizeof(bindingnames), "%s", getStringFromConfig(gkf, "controller", "bindings", ""));
 #elif __WIN32__
-    joystickID = GetPrivateProfileInt("controller", "id", 0, CONFIG_FILE);
+    configFile config = CONFIG_FILE;
+    GetPrivateProfileString("controller", "bindings", "", bindingnames, sizeof(bindingnames), CONFIG_FILE);
 #else
     fprintf(stderr, "Need a way to read a .ini file!\n");
 #endif
 
-    printTime();
-    printf("Using joystick %i\n", joystickID);
-    joystick = SDL_JoystickOpen(joystickID);
-    if (joystick == NULL) {
-        fprintf(stderr, "Error: %s\n", SDL_GetError());
-        exit(1);
-    }
-    SDL_JoystickEventState(SDL_ENABLE);
-
-
-    // Networking...
-    char *remote_host;
-    int server_port;
-#ifdef  __linux__
-    remote_host = getStringFromConfig(gkf, "network", "remote_host", REMOTE_HOST);
-    server_port = getIntFromConfig(gkf, "network", "server_port", SERVER_PORT);
-#elif __WIN32__
-    remote_host = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-    GetPrivateProfileString("network", "remote_host", REMOTE_HOST, remote_host, STRING_BUFFER_LENGTH, CONFIG_FILE);
-    server_port = GetPrivateProfileInt("network", "server_port", SERVER_PORT, CONFIG_FILE);
-#endif
-    if (server_port < 0 || server_port > 65534) {
-        server_port = SERVER_PORT;
-    }
-    printTime();
-    printf("Sending to %s:%i\n", remote_host, server_port);
-
-    remote.nextpacket = 0;
-    remote.lastPacketTime = SDL_GetTicks();
-    SDLNet_ResolveHost(&remote.remoteAddr, remote_host, server_port);
-    remote.udpsocket = SDLNet_UDP_Open(0);
-    if (!remote.udpsocket) {
-        fprintf(stderr, "SDLNet_UDP_Open: %s\n", SDLNet_GetError());
-        exit(4);
+    // each named binding is a joystick and robot with its own [name:section]s,
+    // without any names there's one binding set up by the plain sections
+    char *names[MAX_BINDINGS];
+    char *name = strtok(bindingnames, ", ");
+    while (name != NULL && numBindings < MAX_BINDINGS) {
+        names[numBindings++] = name;
+        name = strtok(NULL, ", ");
     }
-    remote.packet = SDLNet_AllocPacket(PACKET_LENGTH);
-    if (!remote.packet) {
-        fprintf(stderr, "SDLNet_AllocPacket: %s\n", SDLNet_GetError());
+    // only as many as are used, they're big and real-time mode locks them in memory
+    bindings = calloc(numBindings > 0 ? numBindings : 1, sizeof(robotBinding));
+    if (bindings == NULL) {
+        fprintf(stderr, "Couldn't allocate %i bindings\n", numBindings);
         exit(5);
     }
-
-
-    // read in robot configurations
-    int numMotors = 2; unsigned long idle_timeout;
-#ifdef  __linux__
-    numMotors = getIntFromConfig(gkf, "robot", "num_motors", 2);
-    idle_timeout = getIntFromConfig(gkf, "robot", "idle_timeout", 120)*1000;
-#elif __WIN32__
-    numMotors = GetPrivateProfileInt("robot", "num_motors", 2, CONFIG_FILE);
-    idle_timeout = GetPrivateProfileInt("robot", "idle_timeout", 120, CONFIG_FILE)*1000;
-#endif
-    if (numMotors < 0 || numMotors > MAX_NUM_MOTORS) {
-        numMotors = SERVER_PORT;
-    }
-    printTime();
-    printf("Using %i motors, becoming idle after %li s\n", numMotors, idle_timeout/1000);
-    robotstate.numMotors = numMotors;
-    laststate.numMotors = numMotors;
-
-
-    // setup trim
-    int trim_min[MAX_NUM_MOTORS], trim_max[MAX_NUM_MOTORS];
-    char *keyname = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-    char *keyname2 = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-    for (i = 0; i < numMotors; i++) {
-        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_min", motornames[i]);
-        snprintf(keyname2, STRING_BUFFER_LENGTH, "%s_max", motornames[i]);
-#ifdef  __linux__
-        trim_min[i] = getIntFromConfig(gkf, "trim", keyname, 0);
-        trim_max[i] = getIntFromConfig(gkf, "trim", keyname2, MYPWMRANGE);
-#elif __WIN32__
-        trim_min[i] = GetPrivateProfileInt("trim", keyname, 0, CONFIG_FILE);
-        trim_max[i] = GetPrivateProfileInt("trim", keyname2, MYPWMRANGE, CONFIG_FILE);
-#endif
-        if (trim_min[i] < 0) trim_min[i] = 0;
-        if (trim_max[i] > MYPWMRANGE) trim_max[i] = MYPWMRANGE;
+    for (i = 0; i < numBindings; i++) {
+        snprintf(bindings[i].name, STRING_BUFFER_LENGTH, "%s", names[i]);
     }
-    free(keyname);
-    free(keyname2);
-
-    printTime();
-    printf("Using ");
-    for (i = 0; i < numMotors; i++) {
-        if (i > 0) {
-            printf(", ");
-        }
-        printf("%s_min = %i, %s_max = %i", motornames[i], trim_min[i], motornames[i], trim_max[i]);
+    if (numBindings == 0) {
+        numBindings = 1;
     }
-    printf("\n");
 
+    SDL_JoystickEventState(SDL_ENABLE);
+    for (i = 0; i < numBindings; i++) {
+        robotBinding *binding = &bindings[i];
 
-    // read in motor directions
-    int axis_dir[MAX_NUM_MOTORS];
-    keyname = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-    for (i = 0; i < numMotors; i++) {
-        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_dir", motornames[i]);
+        // which joystick, by default the first binding gets the first joystick and so on
+        char section[STRING_BUFFER_LENGTH*2];
+        snprintf(section, sizeof(section), "%s%scontroller", binding->name, binding->name[0] != '\0' ? ":" : "");
 #ifdef  __linux__
-        axis_dir[i] = getIntFromConfig(gkf, "dir", keyname, 1);
+        binding->deviceIndex = getIntFromConfig(gkf, section, "id", i);
 #elif __WIN32__
-        axis_dir[i] = GetPrivateProfileInt("dir", keyname, 1, CONFIG_FILE);
+        binding->deviceIndex = GetPrivateProfileInt(section, "id", i, CONFIG_FILE);
 #endif
-        if (axis_dir[i] != -1 && axis_dir[i] != 1) axis_dir[i] = 1;
-    }
-    free(keyname);
+        int error = loadBinding(binding, config);
+        if (error != 0) {
+            exit(error);
+        }
 
-    printTime();
-    printf("Using dir config ");
-    for (i = 0; i < numMotors; i++) {
-        if (i > 0) {
-            printf(", ");
+        if (binding->deviceIndex < 0 || binding->deviceIndex >= SDL_NumJoysticks() \
+            || findBinding(SDL_JoystickGetDeviceInstanceID(binding->deviceIndex)) != NULL \
+            || !attachJoystick(binding, binding->deviceIndex)) {
+            printBinding(binding);
+            printf("Joystick %i isn't available, waiting for it to be plugged in\n", binding->deviceIndex);
         }
-        printf("%s_dir=%i", motornames[i], axis_dir[i]);
     }
-    printf("\n");
 
-
-    // read in axis mapping
-    keyname = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-    for (i = 0; i < numMotors; i++) {
-        snprintf(keyname, STRING_BUFFER_LENGTH, "%s_axis", motornames[i]);
-#ifdef  __linux__
-        axismap[i] = getIntFromConfig(gkf, "axis", keyname, -1);
-#elif __WIN32__
-        axismap[i] = GetPrivateProfileInt("axis", keyname, -1, CONFIG_FILE);
-#endif
-        if (axismap[i] < 0 || axismap[i] > SDL_JoystickNumAxes(joystick)) axismap[i] = -1;
+    // so that the loop can sleep until a reply arrives
+    sockets = SDLNet_AllocSocketSet(numBindings);
+    if (sockets == NULL) {
+        fprintf(stderr, "SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
+        exit(5);
     }
-    free(keyname);
-
-    printTime();
-    printf("Using axis mapping ");
-    for (i = 0; i < numMotors; i++) {
-        if (i > 0) {
-            printf(", ");
+    for (i = 0; i < numBindings; i++) {
+#ifdef __linux__
+        if (bindings[i].remote.useNative) {
+            continue; // waited on with nativeWaitAny()
         }
-        printf("%s_axis=%i", motornames[i], axismap[i]);
-    }
-    printf("\n");
-
-
-    // setup button config variables
-    // a (0), b (1), x (2), y (3), lb (4), rb (5), view (6), menu (7), xbox (8), ls (9), rs (10), up (11), down (12), left (13), right (14)
-    buttonDefinition a_button, b_button, x_button, y_button, 
-        lb_button, rb_button, 
-        view_button, menu_button, 
-#ifndef __WIN32__
-        xbox_button, 
-#endif 
-        ls_button, rs_button, 
-        up_button, down_button, left_button, right_button;
-    buttonDefinition *(allbuttons[]) = {&a_button, &b_button, &x_button, &y_button, 
-        &lb_button, &rb_button, 
-        &view_button, &menu_button, 
-#ifndef __WIN32__
-        &xbox_button, 
 #endif
-        &ls_button, &rs_button, 
-        &up_button, &down_button, &left_button, &right_button};
+        SDLNet_UDP_AddSocket(sockets, bindings[i].remote.udpsocket);
+    }
 
-    Macro macros[NUM_BUTTONS];
-    robotstate.macros = &macros[0];
-    laststate.macros = &macros[0];
 
-    // read in button config options
-#ifdef  __linux__
-    for (i = 0; i < NUM_BUTTONS; i++) {
-        allbuttons[i]->value = getStringFromConfig(gkf, "buttons", buttonnames[i], NULL);
+    // real-time operation is opt in, it needs root or CAP_SYS_NICE
+    int poll_wait = 0;
+#ifdef __linux__
+    int realtime = getIntFromConfig(gkf, "runtime", "realtime", 0);
+    int realtime_priority = getIntFromConfig(gkf, "runtime", "priority", DEFAULT_RT_PRIORITY);
+    int realtime_cpu = getIntFromConfig(gkf, "runtime", "cpu", -1);
+    int realtime_lock = getIntFromConfig(gkf, "runtime", "lock_memory", 1);
+    int realtime_check = getIntFromConfig(gkf, "runtime", "check", realtime);
+    int loop_sleep = getIntFromConfig(gkf, "runtime", "loop_sleep", DEFAULT_LOOP_SLEEP);
+    poll_wait = getIntFromConfig(gkf, "runtime", "poll_wait", 0);
+    if (realtime_priority < 1 || realtime_priority > 99) realtime_priority = DEFAULT_RT_PRIORITY;
+    if (realtime) {
+        printTime();
+        printf("Real-time mode, SCHED_FIFO priority %i, CPU %i, %s memory, sleeping %i us per loop\n", realtime_priority, realtime_cpu, realtime_lock ? "locked" : "unlocked", loop_sleep);
+        poll_wait = 0; // the loop paces itself
     }
 
     g_key_file_free(gkf); // this is the last config we need to read, so close it
 #elif __WIN32__
-    for (i = 0; i < NUM_BUTTONS; i++) {
-        allbuttons[i]->value = (char *)malloc(STRING_BUFFER_LENGTH * sizeof(char));
-        GetPrivateProfileString("buttons", buttonnames[i], "", allbuttons[i]->value, STRING_BUFFER_LENGTH, CONFIG_FILE);
-    }
+    poll_wait = GetPrivateProfileInt("runtime", "poll_wait", 0, CONFIG_FILE);
 #endif
-
-    // for each button, read in its macro or set its type appropriately
-    for (i = 0; i < NUM_BUTTONS; i++) {
-        macros[i].length = -1;
-        macros[i].running = 0;
-        allbuttons[i]->macro = &macros[i];
-
-        // start by handling special cases
-        if (strcmp(allbuttons[i]->value, "fast") == 0) { //strcmp returns 0 when the strings match
-            allbuttons[i]->type = FAST;
-        }
-        else if (strcmp(allbuttons[i]->value, "slow") == 0) {
-            allbuttons[i]->type = SLOW;
-        }
-        else if (strcmp(allbuttons[i]->value, "invertoff") == 0) {
-            allbuttons[i]->type = INVERTOFF;
-        }
-        else if (strcmp(allbuttons[i]->value, "inverton") == 0) {
-            allbuttons[i]->type = INVERTON;
-        }
-        else if (strcmp(allbuttons[i]->value, "enable") == 0) {
-            allbuttons[i]->type = ENABLE;
-        }
-        else if (strcmp(allbuttons[i]->value, "stop") == 0) {
-            allbuttons[i]->type = STOP;
-        }
-        else if (strcmp(allbuttons[i]->value, "exit") == 0) {
-            allbuttons[i]->type = EXIT;
-        }
-        else if (strlen(allbuttons[i]->value) == 0) { // nothing is programmed
-            allbuttons[i]->type = NONE;
-        }
-        else { // read in macro
-            if (access(allbuttons[i]->value, F_OK) != 0) { // the macro file does not exist!
-                fprintf(stderr, "file %s doesn't exist, assuming no macro\n", allbuttons[i]->value);
-                allbuttons[i]->value = "";
-                allbuttons[i]->type = NONE;
-            }
-            else {
-                allbuttons[i]->type = MACRO;
-                if (readMacro(allbuttons[i]->value, allbuttons[i]->macro, numMotors) == 0) {
-                    fprintf(stderr, "formatting error reading macro %s\n", allbuttons[i]->value); 
-                    exit(6);
-                }
-            }
-        }
+    // waiting for input or replies instead of spinning, cut short whenever a
+    // heartbeat, macro step or recording sample is due
+    if (poll_wait < 0) poll_wait = 0;
+    if (poll_wait > HEARTBEAT_TIMEOUT/5) poll_wait = HEARTBEAT_TIMEOUT/5;
+    if (poll_wait > 0) {
+        printTime();
+        printf("Waiting up to %i ms for input each loop\n", poll_wait);
     }
 
-    // print a summary of the buttons
-    printTime();
-    printf("Using a=%s, b=%s, x=%s, y=%s\n", \
-        a_button.value, b_button.value, x_button.value, y_button.value);
-    printTime();
-    printf("Using lb=%s, rb=%s, view=%s, menu=%s\n", \
-        lb_button.value, rb_button.value, view_button.value, menu_button.value);
-    printTime();
-#ifndef __WIN32__
-    printf("Using xbox=%s, ls=%s, rs=%s\n", \
-        xbox_button.value, ls_button.value, rs_button.value);
-#else
-    printf("Using ls=%s, rs=%s\n", \
-        ls_button.value, rs_button.value);
-#endif
-    printTime();
-    printf("Using up=%s, down=%s, left=%s, right=%s\n", \
-        up_button.value, down_button.value, left_button.value, right_button.value);
-
 
     // Main loop
     SDL_Event event;
     int running = 1;
-    unsigned long last_input = 0;
+#ifdef __linux__
+    // everything the loop needs has been allocated by now
+    if (realtime && !enableRealtime(realtime_priority, realtime_cpu, realtime_lock)) {
+        fprintf(stderr, "Couldn't fully enable real-time mode, continuing anyway\n");
+    }
+    unsigned long last_check = SDL_GetTicks();
+    if (realtime_check) {
+        startRealtimeCheck();
+    }
+#endif
     while (running) {
-        copystate(&robotstate, &laststate);
-
-
-        // heart beat
-        if (SDL_GetTicks() - remote.lastPacketTime > HEARTBEAT_TIMEOUT) {
-            sendPacket(&remote, 0, 0);
-//            printf("Sending heartbeat (%d)!\n", nextpacket);
-        }
-
-
-        // idle time out
-        if (SDL_GetTicks() - last_input > idle_timeout && robotstate.enabled == 1) {
-            sendPacket(&remote, 255, 0); // any other button, stop!
-            robotstate.enabled = 0;
-            for (int i = 0; i < robotstate.numMotors; i++) {
-                robotstate.axis[i] = 0;
-            }
-            for (int i = 0; i < NUM_BUTTONS; i++) {
-                if (robotstate.macros[i].length != 0) {
-                    robotstate.macros[i].running = 0;
+        now = SDL_GetTicks();
+#ifdef __linux__
+        long faults, allocations;
+        if (realtime_check && now - last_check > REALTIME_CHECK_INTERVAL) {
+            if (realtimeCheck(&faults, &allocations)) {
+                printTime();
+                if (allocations >= 0) {
+                    printf("Warning: %li page faults and %li allocations since startup\n", faults, allocations);
+                }
+                else { // only counted by the check build
+                    printf("Warning: %li page faults since startup\n", faults);
                 }
             }
-            printTime();
-            printf("Idle after %li seconds, stopping motors...\n", idle_timeout/1000);
+            last_check = now;
         }
+#endif
 
 
-        // recieve all waiting packets
-        while (SDLNet_UDP_Recv(remote.udpsocket, remote.packet) == 1) {
-            printTime();
-            printf("Packet recieved...\n");
+        // sleep until there's input or a reply, or a robot has something to do
+        if (poll_wait > 0) {
+            long timeout = poll_wait;
+            for (i = 0; i < numBindings; i++) {
+                long due = bindingDue(&bindings[i], now);
+                if (due != -1 && due < timeout) {
+                    timeout = due;
+                }
+            }
+            if (timeout > 0) {
+                waitForInput(bindings, numBindings, sockets, timeout);
+            }
         }
 
-
-        // handle input
-        while(SDL_PollEvent(&event) != 0) {
+        // handle input, each joystick's events go to its binding
+        while (SDL_PollEvent(&event) != 0) {
+            robotBinding *binding = NULL;
             switch(event.type) {
-                case SDL_JOYAXISMOTION:  /* Handle Joystick Motion */
-                    for (i = 0; i < numMotors; i++) {
-                        if (event.jaxis.axis == axismap[i]) {
-                            robotstate.axis[i] = axisvalueconversion(event.jaxis.value);
-                        }
-                    }
+                case SDL_JOYAXISMOTION:
+                    binding = findBinding(event.jaxis.which);
                     break;
 
-                case SDL_JOYBUTTONDOWN:  /* Handle Joystick Button Presses */
-                    printTime();
-                    printf("%s button: ", buttonnames[event.jbutton.button]);
-                    executeButton(&remote, &robotstate, allbuttons[event.jbutton.button]);
+                case SDL_JOYBUTTONDOWN:
+                    binding = findBinding(event.jbutton.which);
                     break;
 
-                case SDL_JOYHATMOTION:  /* Handle Hat Motion */
-                    if (event.jhat.value == 1) {
-                        printTime();
-                        printf("up button: ");
-                        executeButton(&remote, &robotstate, &up_button);
-                    }
-                    else if (event.jhat.value == 4) {
-                        printTime();
-                        printf("down button: ");
-                        executeButton(&remote, &robotstate, &down_button);
-                    }
-                    else if (event.jhat.value == 8) {
-                        printTime();
-                        printf("left button: ");
-                        executeButton(&remote, &robotstate, &left_button);
-                    }
-                    else if (event.jhat.value == 2) {
-                        printTime();
-                        printf("right button: ");
-                        executeButton(&remote, &robotstate, &right_button);
-                    }
-                    else {
-//                        printf("dpad %i pressed\n", event.jhat.value);
+                case SDL_JOYHATMOTION:
+                    binding = findBinding(event.jhat.which);
+                    break;
+
+                case SDL_JOYDEVICEADDED: // which is a device index here...
+                    binding = bindingForDevice(bindings, numBindings, event.jdevice.which);
+                    if (binding != NULL) {
+                        attachJoystick(binding, event.jdevice.which);
                     }
+                    binding = NULL;
                     break;
 
-                case SDL_JOYDEVICEREMOVED:
-                    printTime();
-                    printf("Joystick removed!\n");
+                case SDL_JOYDEVICEREMOVED: // ...and an instance ID here, the other robots carry on
+                    binding = findBinding(event.jdevice.which);
+                    if (binding != NULL) {
+                        detachJoystick(binding);
+                    }
+                    binding = NULL;
+                    break;
 
                 case SDL_QUIT:
                     running = 0;
                     printTime();
                     break;
             }
-
-            last_input = SDL_GetTicks();
+            if (binding != NULL) {
+                bindingEvent(binding, &event);
+            }
         }
 
 
-        // execute macros
+        // talk to each robot
         now = SDL_GetTicks();
-        for (i = 0; i < NUM_BUTTONS; i++) {
-            if (macros[i].length > 0 && macros[i].running > 0) {
-                if (macros[i].at == 0 || ((now - macros[i].running < macros[i].times[macros[i].at] && now - macros[i].running > macros[i].times[macros[i].at-1]) && macros[i].at < macros[i].length)) {
-                    printTime();
-                    printf("Macro %s command %i/%i (", allbuttons[i]->value, macros[i].at+1, macros[i].length);
-                    for (j = 0; j < numMotors; j++) {
-                        if (j > 0) {
-                            printf(", ");
-                        }
-                        printf("%f", macros[i].velocities[j][macros[i].at]);
-                    }
-                    printf(")\n");
-
-                    for (j = 0; j < numMotors; j++) {
-                        robotstate.axis[j] = macros[i].velocities[j][macros[i].at];
-                    }
-                    macros[i].at++;
-                }                        
-                else if (now - macros[i].running > macros[i].times[macros[i].at-1]) {
-                    printTime();
-                    printf("Macro %s finished\n", allbuttons[i]->value);
-                    for (j = 0; j < numMotors; j++) {
-                        robotstate.axis[j] = axisvalueconversion(SDL_JoystickGetAxis(joystick, axismap[j]));
-                    }
-                    macros[i].running = 0;
-                }
-            }
+        for (i = 0; i < numBindings; i++) {
+            updateBinding(&bindings[i], now);
         }
-
-
-        // send commands to the robot
-        if (robotstate.enabled == 1) {
-            for (i = 0; i < numMotors; i++) {
-                if (robotstate.axis[i] != laststate.axis[i] || robotstate.speed != laststate.speed || robotstate.invert != laststate.invert) {
-                    j = i;
-                    k = 1;
-                    if (robotstate.invert == 1) {
-                        k = -1;
-                        if (j == 1) {
-                            j = 0;
-                        }
-                        else {
-                            j = 1;
-                        }
-                    }
-                    updateMotor(&remote, (j+1)*10, k * robotstate.axis[i] / robotstate.speed, trim_min[j], trim_max[j], axis_dir[j]);
-                }
-            }
+#ifdef __linux__
+        if (realtime) {
+            loopSleep(loop_sleep);
         }
+#endif
     }
 
 
     // we're quitting, stop everything!
-    sendPacket(&remote, 255, 0);
+    for (i = 0; i < numBindings; i++) {
+        sendPacket(&bindings[i].remote, 255, 0);
+    }
 
-    for (i = 0; i < NUM_BUTTONS; i++) {
-        if (allbuttons[i]->macro->length > 0) {
-            if (allbuttons[i]->macro->times != NULL) {
-                free(allbuttons[i]->macro->times);
-            }
-            for (j = 0; j < numMotors; j++) {
-                if (allbuttons[i]->macro->velocities[j] != NULL) {
-                    free(allbuttons[i]->macro->velocities[j]);
-                }
-            }
+#ifdef __linux__
+    if (realtime_check) {
+        long faults, allocations;
+        realtimeCheck(&faults, &allocations);
+        printTime();
+        if (allocations >= 0) {
+            printf("%li page faults and %li allocations after startup\n", faults, allocations);
         }
-#if __WIN32__
-        if (allbuttons[i]->value != NULL) {
-            free(allbuttons[i]->value);
+        else {
+            printf("%li page faults after startup\n", faults);
         }
-#endif
     }
+#endif
 
 
     return 0;
@@ -4,11 +4,18 @@
 #include <SDL2/SDL.h>
 
 #define JOYSTICK_MAX 32768
+#define JOYSTICK_RANGE 65536 // number of possible axis values, for lookup tables
 #define DEADZONE (JOYSTICK_MAX/10)
+#define MAX_NUM_AXES 8
+#define MIX_WIDTH 8 // MAX_NUM_MOTORS rounded up so that mixing vectorises
 
 // the relative path here is required for the Windows INI functions
 #define CONFIG_FILE "./config.ini"
 #define STRING_BUFFER_LENGTH 32
+#define MACRO_POOL_SIZE 16384 // total macro steps for all buttons
+#define RECORD_LENGTH 16384 // samples in a recording, over five minutes at the default interval
+#define RECORD_INTERVAL 20 // ms between samples
+#define RECORD_MAX_ERROR 0.02 // how far a recorded macro may stray from what was driven
 
 #define REMOTE_HOST "192.168.4.1"
 
@@ -23,8 +30,6 @@
     #define MYDATE "unknown"
 #endif
 
-extern SDL_Joystick *joystick;
-
 typedef struct {
     int length;
     unsigned long *times;
@@ -36,21 +41,52 @@ typedef struct {
 } Macro;
 
 // things each Xbox controller button can do
-typedef enum {NONE, MACRO, FAST, SLOW, INVERTOFF, INVERTON, ENABLE, DISABLE, STOP, EXIT} buttonType;
+typedef enum {NONE, MACRO, FAST, SLOW, INVERTOFF, INVERTON, ENABLE, DISABLE, STOP, EXIT, RECORD} buttonType;
 typedef struct {
     char *value;
     buttonType type; // value from enum buttonType
     Macro *macro;
 } buttonDefinition;
+
+// Motor values captured while driving, turned into a macro when recording stops
+typedef struct {
+    unsigned long started; // 0 when not recording
+    unsigned long lastSample;
+    unsigned long interval;
+    float maxError;
+    char file[STRING_BUFFER_LENGTH*4]; // where the macro is saved
+    buttonDefinition *target; // button the macro is bound to
+    int unsaved; // the macro bound to target hasn't been written to file yet
+    int length;
+    unsigned long times[RECORD_LENGTH]; // ms since started
+    float samples[MAX_NUM_MOTORS][RECORD_LENGTH];
+} Recording;
 extern const char *buttonnames[];
 
+// Joystick axes to motor values, all the expensive bits precomputed
+typedef struct {
+    float curves[MAX_NUM_AXES][JOYSTICK_RANGE]; // deadzone and expo applied to every possible axis value
+    float mix[MAX_NUM_AXES][MIX_WIDTH]; // weight of each axis for each motor
+    float inputs[MAX_NUM_AXES]; // current shaped axis values
+    unsigned int axismask[MAX_NUM_MOTORS]; // bit set for each axis a motor uses
+    unsigned int changed; // bit set for each axis that has changed since the last mix
+    int invertmap[MAX_NUM_MOTORS]; // which motor each motor drives when inverted
+    float slew[MAX_NUM_MOTORS]; // maximum change in motor value per ms, 0 for no limit
+    float output[MAX_NUM_MOTORS]; // motor values after inversion, speed and slew
+    unsigned long lastOutput;
+    int numAxes;
+    int numMotors;
+} inputPipeline;
+
 typedef struct {
     int speed; // = 1; // 1 - fast, 2 - slow
     int invert; // = 0; // 1 or 0 (do it or don't)
     int enabled;
     float axis[MAX_NUM_MOTORS];
     Macro *macros;
-    int *axismap;
+    inputPipeline *pipeline;
+    SDL_Joystick *joystick; // NULL while unplugged
+    Recording *recording; // NULL if this robot can't record
     int numMotors;
 } robotState;
 
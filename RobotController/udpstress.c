@@ -0,0 +1,460 @@
+/*
+
+udpstress
+
+Flood a receiver with control packets to find the highest command rate it
+keeps up with, and check that it copes with malformed packets. Packets are
+made with the controller's own sendPacket() encoding and sent through the
+native backend. Heartbeats are sent at a fixed interval alongside the flood,
+and their EHLO replies show whether the receiver is keeping up.
+
+In constant mode packets are spread evenly at the target rate. In burst mode
+the same average rate is sent in bursts back to back. In ramp mode the
+rate goes up by half each step until heartbeats start going unanswered, and
+the last rate at which they all were is reported. It also stops when we can't
+send any faster, or after RAMP_MAX_STEPS steps. A heartbeat answered after the
+reply timeout counts as a timeout, not as answered.
+
+The command mix is given as weights for motor setpoints, motor enables,
+capability requests and unknown commands (100-199). Fuzzed packets have one
+of their length, packet ID, command or argument replaced by a random value.
+Commands 254 and 255 are never sent, as they reset or stop the receiver.
+
+After the runs the receiver must still answer heartbeats, otherwise the exit
+status is 1. This can be run against RobotReceiver's host build, see
+`make stress`.
+
+Usage: udpstress [-h host] [-p port] [-m constant|burst|ramp] [-r rate]
+       [-b burst] [-t seconds] [-w setpoint,enable,caps,unknown] [-z fuzz]
+       [-i heartbeat ms] [-T reply timeout ms] [-s seed]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "../robot.h"
+#include "robotcontroller.h"
+#include "controllerfunctions.h"
+
+#define DEFAULT_RATE 1000 // packets per second
+#define DEFAULT_BURST 50
+#define DEFAULT_SECONDS 5
+#define DEFAULT_INTERVAL 100 // ms between heartbeats
+#define HEARTBEAT_SLOTS 256 // heartbeats that can be waiting for a reply at once
+#define RAMP_FACTOR 1.5
+#define RAMP_MAX_RATE 10000000
+#define RAMP_MAX_STEPS 20 // so that a ramp always ends, 20 steps from 1000/s reaches 3.3M/s
+#define STARTUP_TIMEOUT (CONTROLLER_TIMEOUT + EMERGENCY_STOP_TIMEOUT + 1000) // a previous controller may have to time out first
+
+const char *buttonnames[] = {"a", "b", "x", "y", "lb", "rb", "view", "menu", "xbox", "ls", "rs", "up", "down", "left", "right"};
+
+typedef enum {CONSTANT, BURST, RAMP} stressMode;
+typedef enum {PACKET_SETPOINT, PACKET_ENABLE, PACKET_CAPS, PACKET_UNKNOWN, NUM_PACKET_KINDS} packetKind;
+
+typedef struct {
+    unsigned long sent;
+    unsigned long fuzzed;
+    unsigned long replies;
+    unsigned long heartbeats;
+    unsigned long answered;
+    unsigned long timeouts;
+    double elapsed;
+    double *latencies; // us, one for each answered heartbeat
+} stressResult;
+
+// heartbeats waiting for their EHLO
+Uint32 heartbeatIDs[HEARTBEAT_SLOTS];
+double heartbeatTimes[HEARTBEAT_SLOTS];
+int heartbeatPending[HEARTBEAT_SLOTS];
+int nextSlot = 0;
+
+double nowus() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int comparedouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+Uint32 random32() {
+    return ((Uint32)rand() << 16) ^ (Uint32)rand();
+}
+
+void sendStressHeartbeat(UDPremote *remote, stressResult *result) {
+    sendPacket(remote, 0, 0);
+    if (heartbeatPending[nextSlot]) {
+        result->timeouts++; // waited so long its slot has come round again
+    }
+    heartbeatIDs[nextSlot] = remote->nextpacket;
+    heartbeatTimes[nextSlot] = nowus();
+    heartbeatPending[nextSlot] = 1;
+    nextSlot = (nextSlot + 1) % HEARTBEAT_SLOTS;
+    result->heartbeats++;
+}
+
+// Read every waiting reply, matching EHLOs up with their heartbeats. One that
+// took longer than the timeout counts as a timeout.
+void readReplies(UDPremote *remote, stressResult *result, unsigned long maxLatencies, double timeout) {
+    Uint32 packetID, command, argument;
+    while (receivePacket(remote, &packetID, &command, &argument) == 1) {
+        result->replies++;
+        if (command != 1) {
+            continue;
+        }
+        for (int i = 0; i < HEARTBEAT_SLOTS; i++) {
+            if (heartbeatPending[i] && heartbeatIDs[i] == argument) {
+                double latency = nowus() - heartbeatTimes[i];
+                heartbeatPending[i] = 0;
+                if (latency > timeout) {
+                    result->timeouts++;
+                    break;
+                }
+                if (result->answered < maxLatencies) {
+                    result->latencies[result->answered] = latency;
+                }
+                result->answered++;
+                break;
+            }
+        }
+    }
+}
+
+void expireHeartbeats(stressResult *result, double now, double timeout) {
+    for (int i = 0; i < HEARTBEAT_SLOTS; i++) {
+        if (heartbeatPending[i] && now - heartbeatTimes[i] > timeout) {
+            heartbeatPending[i] = 0;
+            result->timeouts++;
+        }
+    }
+}
+
+// Queue one packet of the given kind, fuzzing it if asked
+void queueStressPacket(UDPremote *remote, packetKind kind, int fuzz, stressResult *result) {
+    Uint32 command, argument = 0;
+    int motor = rand() % remote->caps.numMotors;
+    switch (kind) {
+        case PACKET_SETPOINT:
+            command = (motor+1)*10 + 5 + rand() % 2;
+            argument = rand() % (remote->caps.pwmRange + 1);
+            break;
+        case PACKET_ENABLE:
+            command = (motor+1)*10;
+            break;
+        case PACKET_CAPS:
+            command = 3;
+            argument = CAPABILITY(PROTOCOL_VERSION, remote->caps.numMotors);
+            break;
+        default:
+            command = 100 + rand() % 100;
+            argument = random32();
+            break;
+    }
+    if (!fuzz) {
+        sendPacket(remote, command, argument);
+        return;
+    }
+
+    Uint8 data[PACKET_LENGTH];
+    int len = 12;
+    Uint32 packetID = ++remote->nextpacket;
+    switch (rand() % 4) {
+        case 0:
+            do {
+                len = rand() % (PACKET_LENGTH + 1);
+            } while (len == 12);
+            break;
+        case 1:
+            packetID = random32();
+            break;
+        case 2:
+            do {
+                command = random32() % (rand() % 2 ? 256 : 0xFFFFFFFF);
+            } while (command == 254 || command == 255);
+            break;
+        default:
+            argument = random32();
+            break;
+    }
+    for (int i = 0; i < PACKET_LENGTH; i++) {
+        data[i] = rand();
+    }
+    SDLNet_Write32(packetID, data);
+    SDLNet_Write32(command, data+4);
+    SDLNet_Write32(argument, data+8);
+    sendRawPacket(remote, data, len);
+    result->fuzzed++;
+}
+
+// Sleep until a time from nowus(), or until a reply arrives
+void waitUntil(UDPremote *remote, double until) {
+    double wait = until - nowus();
+    if (wait <= 0) {
+        return;
+    }
+    struct pollfd pfd = {remote->native.fd, POLLIN, 0};
+    struct timespec timeout;
+    timeout.tv_sec = (time_t)(wait / 1e6);
+    timeout.tv_nsec = (long)((wait - timeout.tv_sec * 1e6) * 1e3);
+    ppoll(&pfd, 1, &timeout, NULL);
+}
+
+packetKind pickKind(const int *weights, int total) {
+    int pick = rand() % total;
+    for (int i = 0; i < NUM_PACKET_KINDS; i++) {
+        if (pick < weights[i]) {
+            return i;
+        }
+        pick -= weights[i];
+    }
+    return PACKET_SETPOINT;
+}
+
+void runStress(UDPremote *remote, double rate, int burst, int seconds, const int *weights, float fuzz,
+        int interval, int replyTimeout, stressResult *result) {
+    unsigned long maxLatencies = (unsigned long)seconds * 1000 / interval + HEARTBEAT_SLOTS;
+    double *latencies = result->latencies;
+    memset(result, 0, sizeof(stressResult));
+    result->latencies = latencies;
+    memset(heartbeatPending, 0, sizeof(heartbeatPending));
+
+    int total = 0;
+    for (int i = 0; i < NUM_PACKET_KINDS; i++) {
+        total += weights[i];
+    }
+
+    unsigned long queued = 0;
+    double start = nowus(), now = start, lastHeartbeat = 0;
+    double end = start + seconds * 1e6;
+    while (now < end) {
+        now = nowus();
+        if (now - lastHeartbeat >= interval * 1e3) {
+            sendStressHeartbeat(remote, result);
+            lastHeartbeat = now;
+        }
+
+        // how many packets should have gone by now
+        double elapsed = (now - start) / 1e6;
+        unsigned long due = burst > 1 ? (unsigned long)(elapsed * rate / burst + 1) * burst : (unsigned long)(elapsed * rate);
+        // stop catching up at the end, or a rate we can't send at would never end
+        while (queued < due && nowus() < end) {
+            int batch = 0;
+            while (queued < due && batch < NATIVE_SEND_BATCH - 1) { // leave room for a heartbeat
+                queueStressPacket(remote, pickKind(weights, total), rand() < fuzz * RAND_MAX, result);
+                queued++;
+                batch++;
+            }
+            result->sent += nativeFlush(&remote->native);
+        }
+        result->sent += nativeFlush(&remote->native); // heartbeats
+
+        // expire first, a reply to an overdue heartbeat mustn't count as an answer
+        expireHeartbeats(result, nowus(), replyTimeout * 1e3);
+        readReplies(remote, result, maxLatencies, replyTimeout * 1e3);
+        // sleep until the next packet or heartbeat is due
+        double next = start + (burst > 1 ? (double)queued / rate : (queued + 1) / rate) * 1e6;
+        if (next > lastHeartbeat + interval * 1e3) {
+            next = lastHeartbeat + interval * 1e3;
+        }
+        waitUntil(remote, next);
+    }
+    // sent only counts what the socket accepted, so this is the rate we really sent at
+    now = nowus();
+    result->elapsed = (now - start) / 1e6;
+
+    // give the last heartbeats a chance to be answered
+    while (nowus() - now < replyTimeout * 1e3) {
+        nativeWait(&remote->native, 1);
+        readReplies(remote, result, maxLatencies, replyTimeout * 1e3);
+    }
+    expireHeartbeats(result, nowus(), 0);
+}
+
+void printResult(const char *name, double rate, const stressResult *result, unsigned long maxLatencies) {
+    unsigned long n = result->answered < maxLatencies ? result->answered : maxLatencies;
+    printf("%-8s %9.0f %9.0f %8lu %9.0f %7lu/%-7lu %7lu", name, rate, result->sent / result->elapsed, result->fuzzed,
+        result->replies / result->elapsed, result->answered, result->heartbeats, result->timeouts);
+    if (n > 0) {
+        qsort(result->latencies, n, sizeof(double), comparedouble);
+        double mean = 0;
+        for (unsigned long i = 0; i < n; i++) {
+            mean += result->latencies[i];
+        }
+        printf(" %8.0f %8.0f %8.0f %8.0f\n", mean / n, result->latencies[n/2], result->latencies[(unsigned long)(n*0.99)], result->latencies[n-1]);
+    }
+    else {
+        printf(" %8s %8s %8s %8s\n", "-", "-", "-", "-");
+    }
+}
+
+// A heartbeat answered within the timeout, to check the receiver is alive
+int receiverAnswers(UDPremote *remote, int timeout) {
+    stressResult result;
+    double latency;
+    memset(&result, 0, sizeof(result));
+    result.latencies = &latency;
+    memset(heartbeatPending, 0, sizeof(heartbeatPending));
+    double start = nowus(), lastHeartbeat = 0;
+    while (nowus() - start < timeout * 1e3) {
+        if (nowus() - lastHeartbeat > DEFAULT_INTERVAL * 1e3) {
+            sendStressHeartbeat(remote, &result);
+            nativeFlush(&remote->native);
+            lastHeartbeat = nowus();
+        }
+        nativeWait(&remote->native, 10);
+        readReplies(remote, &result, 1, timeout * 1e3);
+        if (result.answered > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Agree capabilities and enable the motors, so that setpoints are acted on
+int startReceiver(UDPremote *remote, int quiet) {
+    double start = nowus();
+    Uint32 packetID, command, argument;
+    while (remote->caps.state != CAPS_OK) {
+        if (nowus() - start > STARTUP_TIMEOUT * 1e3) {
+            fprintf(stderr, "No capabilities from the receiver\n");
+            return 0;
+        }
+        requestCapabilities(remote, 1, SDL_GetTicks());
+        nativeFlush(&remote->native);
+        nativeWait(&remote->native, 100);
+        SDL_Delay(10); // for the rest of the capabilities
+        while (receivePacket(remote, &packetID, &command, &argument) == 1) {
+            if (command == 4) {
+                capabilityReply(remote, argument, 1);
+            }
+        }
+    }
+    // a new owner's packets are ignored for a while after the receiver's stop
+    if (!receiverAnswers(remote, STARTUP_TIMEOUT)) {
+        fprintf(stderr, "No heartbeat replies from the receiver\n");
+        return 0;
+    }
+    // time out soon after we go so the next run doesn't wait long, but not during the pause between runs
+    sendPacket(remote, 2, quiet);
+    for (unsigned long i = 0; i < remote->caps.numMotors; i++) {
+        sendPacket(remote, (i+1)*10, 0);
+    }
+    nativeFlush(&remote->native);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = SERVER_PORT, burst = DEFAULT_BURST, seconds = DEFAULT_SECONDS, interval = DEFAULT_INTERVAL;
+    int replyTimeout = MIN_CONTROLLER_TIMEOUT;
+    int weights[NUM_PACKET_KINDS] = {20, 1, 1, 0};
+    double rate = DEFAULT_RATE;
+    float fuzz = 0;
+    stressMode mode = CONSTANT;
+    unsigned int seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:m:r:b:t:w:z:i:T:s:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'm':
+                mode = strcmp(optarg, "burst") == 0 ? BURST : strcmp(optarg, "ramp") == 0 ? RAMP : CONSTANT;
+                break;
+            case 'r': rate = atof(optarg); break;
+            case 'b': burst = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'w':
+                if (sscanf(optarg, "%i,%i,%i,%i", &weights[PACKET_SETPOINT], &weights[PACKET_ENABLE], &weights[PACKET_CAPS], &weights[PACKET_UNKNOWN]) != 4) {
+                    rate = 0;
+                }
+                break;
+            case 'z': fuzz = atof(optarg); break;
+            case 'i': interval = atoi(optarg); break;
+            case 'T': replyTimeout = atoi(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default: rate = 0; break;
+        }
+    }
+    int total = weights[PACKET_SETPOINT] + weights[PACKET_ENABLE] + weights[PACKET_CAPS] + weights[PACKET_UNKNOWN];
+    if (rate <= 0 || burst <= 0 || seconds <= 0 || interval <= 0 || replyTimeout <= 0 || total <= 0 ||
+            weights[PACKET_SETPOINT] < 0 || weights[PACKET_ENABLE] < 0 || weights[PACKET_CAPS] < 0 || weights[PACKET_UNKNOWN] < 0) {
+        fprintf(stderr, "Usage: %s [-h host] [-p port] [-m constant|burst|ramp] [-r rate] [-b burst] [-t seconds]\n", argv[0]);
+        fprintf(stderr, "       [-w setpoint,enable,caps,unknown] [-z fuzz] [-i heartbeat ms] [-T reply timeout ms] [-s seed]\n");
+        return 1;
+    }
+    srand(seed);
+
+    if (SDL_Init(0) < 0 || SDLNet_Init() < 0) {
+        fprintf(stderr, "Couldn't initialise SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+    UDPremote remote;
+    memset(&remote, 0, sizeof(remote));
+    if (SDLNet_ResolveHost(&remote.remoteAddr, host, port) < 0) {
+        fprintf(stderr, "Couldn't resolve %s: %s\n", host, SDLNet_GetError());
+        return 1;
+    }
+    if (!nativeOpen(&remote.native, &remote.remoteAddr, DEFAULT_DSCP, DEFAULT_SO_PRIORITY)) {
+        return 1;
+    }
+    remote.useNative = 1;
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(remote.native.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    printTime();
+    printf("Stressing %s:%i\n", host, port);
+    if (!startReceiver(&remote, 2 * replyTimeout + interval)) {
+        return 1;
+    }
+
+    stressResult result;
+    unsigned long maxLatencies = (unsigned long)seconds * 1000 / interval + HEARTBEAT_SLOTS;
+    result.latencies = (double *)malloc(sizeof(double) * maxLatencies);
+    printf("mode        target   sent/s   fuzzed replies/s   answered timeouts  mean us   p50 us   p99 us   max us\n");
+    if (mode == RAMP) {
+        double lastGood = 0;
+        const char *reason = "the maximum rate was reached";
+        for (int step = 0; rate < RAMP_MAX_RATE; rate *= RAMP_FACTOR, step++) {
+            if (step == RAMP_MAX_STEPS) {
+                reason = "the step limit was reached";
+                break;
+            }
+            runStress(&remote, rate, 1, seconds, weights, fuzz, interval, replyTimeout, &result);
+            printResult("ramp", rate, &result, maxLatencies);
+            if (result.timeouts > 0 || result.answered < result.heartbeats) {
+                reason = "heartbeats went unanswered";
+                break;
+            }
+            if (result.sent < 0.9 * rate * result.elapsed) {
+                reason = "we couldn't send any faster";
+                break;
+            }
+            lastGood = result.sent / result.elapsed;
+        }
+        printf("Highest rate with every heartbeat answered %.0f packets/s, stopped as %s\n", lastGood, reason);
+    }
+    else {
+        runStress(&remote, rate, mode == BURST ? burst : 1, seconds, weights, fuzz, interval, replyTimeout, &result);
+        printResult(mode == BURST ? "burst" : "constant", rate, &result, maxLatencies);
+    }
+
+    // whatever it was sent, the receiver should still be there
+    int alive = receiverAnswers(&remote, CONTROLLER_TIMEOUT);
+    printTime();
+    printf("Receiver %s\n", alive ? "still answering" : "stopped answering");
+
+    nativeClose(&remote.native);
+    free(result.latencies);
+    SDLNet_Quit();
+    SDL_Quit();
+
+    return alive ? 0 : 1;
+}
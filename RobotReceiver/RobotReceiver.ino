@@ -20,6 +20,11 @@
 #include "robot.h"
 
 //#define DEBUG
+//#define ASYNC_RECEIVE // act on packets in the network stack's receive callback instead of polling for them in loop()
+
+#ifdef ASYNC_RECEIVE
+#include <lwip/udp.h>
+#endif
 
 // Pin constants
 #define E_L D8 // "1,2EN" enable driver channels for left motor
@@ -29,6 +34,11 @@
 #define R_F D2 // "3A" right motor forwards
 #define R_R D3 // "4A" right motor reverse
 
+// What the hardware can do, told to the controller in the capability handshake
+#define NUM_MOTORS 2
+#define MOTOR_PWMRANGE 1023 // analogWriteRange() goes higher, but the PWM frequency drops
+#define OPTIONAL_COMMANDS (OPTIONAL_TIMEOUT | OPTIONAL_RESET)
+
 // Set SSID and password for the robot
 const char *ssid = SSID;
 const char *password = WIFIPASS;
@@ -37,18 +47,161 @@ const char *password = WIFIPASS;
 unsigned int localPort = SERVER_PORT;
 
 // UDP support
+#ifdef ASYNC_RECEIVE
+struct udp_pcb *udpPcb;
+#else
 WiFiUDP Udp;
 // Buffer to hold incoming packet
 char packetBuffer[UDP_TX_PACKET_MAX_SIZE];
+#endif
+// Every packet is three 32 bit numbers, PACKET_LENGTH in robot.h is the most the controller allows for
+#define COMMAND_LENGTH 12
 // Reply buffer
-char replyBuffer[PACKET_LENGTH];
+char replyBuffer[COMMAND_LENGTH];
 
 unsigned long nextpacket = 0; // ID of the next outbound packet
-unsigned long lastPacketTime = 0; // time at which the last packet was recieved
-#define PACKET_LENGTH 12
 unsigned long lastEmergencyStop = 0;
 int stopped = 1;
 
+// Controller sessions, so that a second controller joining doesn't fight the first
+#define MAX_SESSIONS 4 // number of controllers tracked at once
+#define SEQUENCE_WINDOW 1000 // packet IDs further behind than this are from a restarted controller
+#define ARBITRATION_LEASE 0 // the first controller to talk keeps control until it goes quiet
+#define ARBITRATION_PRIORITY 1 // the controller with the highest priority (HELO argument) takes control
+#define ARBITRATION ARBITRATION_LEASE
+
+struct controllerSession {
+  IPAddress ip;
+  uint16_t port;
+  unsigned long lastPacketTime; // time at which the last packet was recieved
+  unsigned long lastPacketID; // for dropping duplicate and out of order packets
+  unsigned long priority;
+  unsigned long timeout; // how long the controller can be quiet for, it can ask for less than CONTROLLER_TIMEOUT
+  bool handshake; // the controller has agreed capabilities with us, so can enable motors
+  bool active;
+};
+controllerSession sessions[MAX_SESSIONS];
+int owner = -1; // session in control of the motors, -1 if nobody is
+unsigned long ownerLostTime = 0; // when the last owner's final packet was received, 0 if there was no owner
+bool handoverPending = false; // the new owner hasn't had a command applied yet
+unsigned long lastHandover = 0; // ms between the previous owner going quiet and the new one's first command being applied
+unsigned long maxHandover = 0;
+
+#ifdef ASYNC_RECEIVE
+// Work the receive callback leaves for loop(), so that it only does what's urgent
+#define EVENT_QUEUE_LENGTH 64 // a power of two
+#define REPLY_RESERVE (6 * MAX_SESSIONS) // only replies can use these, a capability reply and an EHLO for each session
+enum eventType {EVENT_REPLY, EVENT_LOG, EVENT_MESSAGE};
+struct receiveEvent {
+  eventType type;
+  IPAddress ip; // where a reply goes, or the controller a message is about
+  uint16_t port;
+  const char *message; // for logging
+  unsigned long id;
+  unsigned long command;
+  unsigned long argument;
+};
+// Single producer (the callback), single consumer (loop()), each only writes its own index
+receiveEvent eventQueue[EVENT_QUEUE_LENGTH];
+unsigned int eventHead = 0;
+unsigned int eventTail = 0;
+unsigned long eventsDropped = 0;
+unsigned long logsDropped = 0; // debug output gives way to replies
+unsigned long logsDroppedShown = 0;
+unsigned int packetsForLED = 0; // counted by the callback, so a flood doesn't fill the queue with LED flashes
+unsigned int packetsShownOnLED = 0;
+bool inCallback = false; // so that what the callback logs waits for loop() to print it
+
+bool pushEvent(const receiveEvent &event) {
+  unsigned int head = eventHead;
+  unsigned int used = head - __atomic_load_n(&eventTail, __ATOMIC_ACQUIRE);
+  if (event.type != EVENT_REPLY && used >= EVENT_QUEUE_LENGTH - REPLY_RESERVE) {
+    logsDropped++; // so that a burst of logging can't crowd out replies
+    return false;
+  }
+  if (used == EVENT_QUEUE_LENGTH) {
+    eventsDropped++; // a lost reply looks like a lost packet to the controller
+    return false;
+  }
+  eventQueue[head % EVENT_QUEUE_LENGTH] = event;
+  __atomic_store_n(&eventHead, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool popEvent(receiveEvent *event) {
+  unsigned int tail = eventTail;
+  if (tail == __atomic_load_n(&eventHead, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *event = eventQueue[tail % EVENT_QUEUE_LENGTH];
+  __atomic_store_n(&eventTail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+#endif
+
+#ifdef DEBUG
+void printPacket(const char *message, unsigned long packetID, unsigned long command, unsigned long argument) {
+  Serial.print(packetID);
+  Serial.print(": ");
+  Serial.print(command);
+  Serial.print(", ");
+  Serial.print(argument);
+  Serial.print(" ");
+  Serial.println(message);
+}
+
+void printMessage(const char *message, unsigned long value, IPAddress ip, uint16_t port) {
+  Serial.print(message);
+  Serial.print(value);
+  if (port != 0) {
+    Serial.print(" from ");
+    Serial.print(ip);
+    Serial.print(":");
+    Serial.print(port);
+  }
+  Serial.println();
+}
+#endif
+
+// Debug output about a packet. Printing is too slow for the receive callback,
+// so from there it's queued for loop() to print
+void logPacket(const char *message, unsigned long packetID, unsigned long command, unsigned long argument) {
+#ifdef DEBUG
+#ifdef ASYNC_RECEIVE
+  if (inCallback) {
+    receiveEvent event = {EVENT_LOG, IPAddress(), 0, message, packetID, command, argument};
+    pushEvent(event);
+    return;
+  }
+#endif
+  printPacket(message, packetID, command, argument);
+#else
+  (void)message;
+  (void)packetID;
+  (void)command;
+  (void)argument;
+#endif
+}
+
+// Debug output of a message followed by a value, and the controller it's about if port isn't 0
+void logMessage(const char *message, unsigned long value, IPAddress ip = IPAddress(), uint16_t port = 0) {
+#ifdef DEBUG
+#ifdef ASYNC_RECEIVE
+  if (inCallback) {
+    receiveEvent event = {EVENT_MESSAGE, ip, port, message, 0, 0, value};
+    pushEvent(event);
+    return;
+  }
+#endif
+  printMessage(message, value, ip, port);
+#else
+  (void)message;
+  (void)value;
+  (void)ip;
+  (void)port;
+#endif
+}
+
 // Battery stuff (check frequency should be higher to avoid WiFi/analogRead() issues it seems)
 #define BATTERY_CHECK_FREQUENCY 10000
 #define BATTERY_CUTOFF_VOLTAGE 7
@@ -63,17 +216,14 @@ void setLED(int instate) {
   LEDstate = instate;
   //digitalWrite(LED_BUILTIN, LEDstate);
   if (LEDstate == HIGH)
-    analogWrite(LED_BUILTIN, MYPWMRANGE);
+    analogWrite(LED_BUILTIN, MOTOR_PWMRANGE);
   else
-    analogWrite(LED_BUILTIN, MYPWMRANGE-8);
-#ifdef DEBUG
-  Serial.print("LED: ");
-  Serial.println(instate);
-#endif
+    analogWrite(LED_BUILTIN, MOTOR_PWMRANGE-MOTOR_PWMRANGE/32);
+  logMessage("LED: ", instate);
 }
 
 // Disable H-bridge and stop motors
-void emergencyStop() {
+void stopMotors() {
   digitalWrite(E_L, LOW);
   digitalWrite(E_R, LOW);
   digitalWrite(L_F, LOW);
@@ -81,86 +231,197 @@ void emergencyStop() {
   digitalWrite(R_F, LOW);
   digitalWrite(R_R, LOW);
 
-  lastEmergencyStop = millis();
   if (stopped != 1) {
     setLED(HIGH);
   }
   stopped = 1;
-#ifdef DEBUG
-  Serial.println("Emergency stopped.");
-#endif
+}
+
+// Stop motors, then ignore commands for a while so that any already on their way don't restart them
+void emergencyStop() {
+  stopMotors();
+  lastEmergencyStop = millis();
+  logMessage("Emergency stopped at ms: ", lastEmergencyStop);
 }
 
 void leftForward(unsigned long velocity) {
   digitalWrite(L_R, LOW);
   analogWrite(L_F, velocity);
-#ifdef DEBUG
-  Serial.print("left forward: ");
-  Serial.println(velocity);
-#endif
+  logMessage("left forward: ", velocity);
 }
 
 void leftReverse(unsigned long velocity) {
   digitalWrite(L_F, LOW);
   analogWrite(L_R, velocity);
-#ifdef DEBUG
-  Serial.print("left reverse: ");
-  Serial.println(velocity);
-#endif
+  logMessage("left reverse: ", velocity);
 }
 
 void rightForward(unsigned long velocity) {
   digitalWrite(R_R, LOW);
   analogWrite(R_F, velocity);
-#ifdef DEBUG
-  Serial.print("right forward: ");
-  Serial.println(velocity);
-#endif
+  logMessage("right forward: ", velocity);
 }
 
 void rightReverse(unsigned long velocity) {
   digitalWrite(R_F, LOW);
   analogWrite(R_R, velocity);
-#ifdef DEBUG
-  Serial.print("right reverse: ");
-  Serial.println(velocity);
-#endif
+  logMessage("right reverse: ", velocity);
 }
 
 // Send a packet
-void sendPacket(unsigned long command, unsigned long argument) {
+void sendPacket(IPAddress ip, uint16_t port, unsigned long command, unsigned long argument) {
   // Make sure reply packet is blank
-  memset(replyBuffer, 0, PACKET_LENGTH);
+  memset(replyBuffer, 0, COMMAND_LENGTH);
 
   // Make so we can maniuplate as unsigned long
-  unsigned long* longReplyBuffer = (unsigned long*)replyBuffer;
+  uint32_t* longReplyBuffer = (uint32_t*)replyBuffer; // not unsigned long, that is 64 bits in the host build
   nextpacket += 1;
   // SDLNet_Write32 uses opposite byte order, so we need to swap it back for the ESP
   longReplyBuffer[0] = __builtin_bswap32(nextpacket);
   longReplyBuffer[1] = __builtin_bswap32(command);
   longReplyBuffer[2] = __builtin_bswap32(argument);
 
-  Udp.beginPacket(Udp.remoteIP(), Udp.remotePort());
-  Udp.write(replyBuffer, PACKET_LENGTH);
+#ifdef ASYNC_RECEIVE
+  // sent from the port packets arrive on, the controller may only accept replies from there
+  struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, COMMAND_LENGTH, PBUF_RAM);
+  if (p == NULL) {
+    return;
+  }
+  memcpy(p->payload, replyBuffer, COMMAND_LENGTH);
+  ip_addr_t address;
+  ip_addr_set_ip4_u32(&address, (uint32_t)ip);
+  udp_sendto(udpPcb, p, &address, port);
+  pbuf_free(p);
+#else
+  Udp.beginPacket(ip, port);
+  Udp.write(replyBuffer, COMMAND_LENGTH);
   Udp.endPacket();
+#endif
+}
+
+// Reply to a controller, later from loop() if we're in the receive callback
+void reply(controllerSession *session, unsigned long command, unsigned long argument) {
+#ifdef ASYNC_RECEIVE
+  receiveEvent event = {EVENT_REPLY, session->ip, session->port, NULL, 0, command, argument};
+  pushEvent(event);
+#else
+  sendPacket(session->ip, session->port, command, argument);
+#endif
+}
+
+// Find the session for a controller, starting a new one if there's room
+int findSession(IPAddress ip, uint16_t port) {
+  int freeSession = -1;
+  for (int ii = 0; ii < MAX_SESSIONS; ii++) {
+    if (sessions[ii].active && sessions[ii].ip == ip && sessions[ii].port == port) {
+      return ii;
+    }
+    if (!sessions[ii].active && freeSession == -1) {
+      freeSession = ii;
+    }
+  }
+  if (freeSession != -1) {
+    sessions[freeSession].ip = ip;
+    sessions[freeSession].port = port;
+    sessions[freeSession].lastPacketTime = millis();
+    sessions[freeSession].lastPacketID = 0;
+    sessions[freeSession].priority = 0;
+    sessions[freeSession].timeout = CONTROLLER_TIMEOUT;
+    sessions[freeSession].handshake = false;
+    sessions[freeSession].active = true;
+    logMessage("New session ", freeSession, ip, port);
+  }
+  return freeSession;
+}
+
+// Hand control of the motors to a session, stopping anything the old owner left running
+void takeOwnership(int session) {
+  if (owner != -1) {
+    // not an emergency stop, the new owner's commands shouldn't be locked out,
+    // it has to enable the motors again before they'll move anyway
+    stopMotors();
+    ownerLostTime = millis();
+  }
+  owner = session;
+  handoverPending = ownerLostTime != 0;
+  logMessage("In control: session ", session);
+}
+
+// The new owner has had its first command applied, which is when the handover is
+// over. After a timeout that's at least the old owner's timeout, plus the end of
+// the emergency stop that caused, a priority takeover is as quick as its HELO
+void finishHandover() {
+  handoverPending = false;
+  lastHandover = millis() - ownerLostTime;
+  if (lastHandover > maxHandover) {
+    maxHandover = lastHandover;
+  }
+  logMessage("Handover took ms: ", lastHandover);
+  logMessage("Worst handover ms: ", maxHandover);
+}
+
+// Forget controllers that have gone quiet, stopping the motors if it was the owner
+void expireSessions() {
+  for (int ii = 0; ii < MAX_SESSIONS; ii++) {
+    if (sessions[ii].active && millis() - sessions[ii].lastPacketTime > sessions[ii].timeout) {
+      sessions[ii].active = false;
+      if (ii == owner) {
+        owner = -1;
+        ownerLostTime = sessions[ii].lastPacketTime;
+      }
+      logMessage("Timed out: session ", ii);
+    }
+  }
+}
+
+// Answer a capability request, returns whether the controller can go on to enable motors
+bool sendCapabilities(controllerSession *session, unsigned long request) {
+  unsigned long version = CAPABILITY_KEY(request);
+  unsigned long motors = CAPABILITY_VALUE(request);
+  bool accepted = version == PROTOCOL_VERSION && motors <= NUM_MOTORS;
+  reply(session, 4, CAPABILITY(CAP_VERSION, PROTOCOL_VERSION));
+  reply(session, 4, CAPABILITY(CAP_MOTORS, NUM_MOTORS));
+  reply(session, 4, CAPABILITY(CAP_PWMRANGE, MOTOR_PWMRANGE));
+  reply(session, 4, CAPABILITY(CAP_COMMANDS, OPTIONAL_COMMANDS));
+  reply(session, 4, CAPABILITY(CAP_END, accepted));
+  logMessage("Capabilities requested, protocol ", version, session->ip, session->port);
+  logMessage(accepted ? "Capabilities accepted, motors " : "Capabilities refused, motors ", motors);
+  return accepted;
+}
+
+// Check a controller has been through the handshake before letting it enable motors
+bool checkHandshake(int session) {
+  if (!sessions[session].handshake) {
+    reply(&sessions[session], 4, CAPABILITY(CAP_END, 0)); // on its own, asks for a handshake
+    logMessage("Enable refused, no handshake: session ", session);
+  }
+  return sessions[session].handshake;
 }
 
 // Process an incoming packet
-void processPacket(unsigned long packetID, unsigned long command, unsigned long argument) {
+void processPacket(int session, unsigned long packetID, unsigned long command, unsigned long argument) {
+  if (argument > MOTOR_PWMRANGE) { // nothing takes more than a PWM value
+    argument = MOTOR_PWMRANGE;
+  }
   switch (command) {
     case 0: // HELO
-      sendPacket(1, packetID); // Send EHLO packet
+      reply(&sessions[session], 1, packetID); // Send EHLO packet
       break;
     case 1: // EHLO
       break; // Do nothing
+    case 2: // Set controller timeout
+      break; // Handled with the session
+    case 3: // Capability request
+      break; // Handled with the session
+    case 4: // Capability
+      break; // Do nothing
 
     case 10: // Left motor enable
+      if (!checkHandshake(session)) break;
       digitalWrite(E_L, HIGH);
       setLED(LOW);
       stopped = 0;
-#ifdef DEBUG
-      Serial.println("left enable");
-#endif
+      logMessage("Left enabled: session ", session);
       break;
     case 11: // Left motor disable
       digitalWrite(E_L, LOW);
@@ -173,12 +434,11 @@ void processPacket(unsigned long packetID, unsigned long command, unsigned long
       break;
 
     case 20: // Right motor enable
+      if (!checkHandshake(session)) break;
       digitalWrite(E_R, HIGH);
       setLED(LOW);
       stopped = 0;
-#ifdef DEBUG
-      Serial.println("right enable");
-#endif
+      logMessage("Right enabled: session ", session);
       break;
     case 21: // Right motor disable
       digitalWrite(E_R, LOW);
@@ -205,6 +465,138 @@ void processPacket(unsigned long packetID, unsigned long command, unsigned long
 }
 
 
+// Act on a packet from a controller
+void handlePacket(const uint32_t *longPacketBuffer, int packetSize, IPAddress ip, uint16_t port) {
+  // Packet probably is expected, process, before it can take up a session
+  if (packetSize != COMMAND_LENGTH) {
+    logPacket("wrong length, ignoring", 0, 0, packetSize);
+    return;
+  }
+  int session = findSession(ip, port);
+
+  // SDLNet_Write32 uses opposite byte order, so we need to swap it back for the ESP
+  unsigned long packetID = __builtin_bswap32(longPacketBuffer[0]);
+  unsigned long packetCommand = __builtin_bswap32(longPacketBuffer[1]);
+  unsigned long packetArg = __builtin_bswap32(longPacketBuffer[2]);
+
+  // Emergency stop as early as possible, whoever it's from
+  if (packetCommand == 255) {
+    emergencyStop();
+    logPacket("emergency stop", packetID, packetCommand, packetArg);
+    return;
+  }
+  if (session == -1) {
+    logPacket("no free sessions, ignoring", packetID, packetCommand, packetArg);
+    return;
+  }
+  if (packetID <= sessions[session].lastPacketID && sessions[session].lastPacketID - packetID < SEQUENCE_WINDOW) {
+    logPacket("stale packet, ignoring", packetID, packetCommand, packetArg);
+    return;
+  }
+
+  sessions[session].lastPacketTime = millis();
+  sessions[session].lastPacketID = packetID;
+  if (packetCommand == 0) {
+    sessions[session].priority = packetArg;
+  }
+  else if (packetCommand == 2) { // Set controller timeout
+    sessions[session].timeout = constrain(packetArg, MIN_CONTROLLER_TIMEOUT, CONTROLLER_TIMEOUT);
+  }
+  else if (packetCommand == 3) { // Capability request, answered whether or not this controller is in control
+    sessions[session].handshake = sendCapabilities(&sessions[session], packetArg);
+  }
+
+  // Decide who's in control
+  if (owner == -1) {
+    takeOwnership(session);
+  }
+#if ARBITRATION == ARBITRATION_PRIORITY
+  else if (session != owner && sessions[session].priority > sessions[owner].priority) {
+    takeOwnership(session);
+  }
+#endif
+
+  logPacket(session == owner ? "" : "not in control", packetID, packetCommand, packetArg);
+
+  if (session == owner) {
+#ifndef ASYNC_RECEIVE
+    // Flash LED to show recieved
+    setLED(!LEDstate);
+#endif
+    if (millis() - lastEmergencyStop > EMERGENCY_STOP_TIMEOUT) {
+      // Only process if we have not just emergency stopped
+      processPacket(session, packetID, packetCommand, packetArg);
+      if (handoverPending) {
+        finishHandover();
+      }
+    }
+#ifdef ASYNC_RECEIVE
+    __atomic_store_n(&packetsForLED, packetsForLED + 1, __ATOMIC_RELEASE); // loop() flashes it instead
+#else
+    if (stopped) {
+       setLED(!LEDstate);
+    }
+#endif
+  }
+}
+
+#ifdef ASYNC_RECEIVE
+// Called by the network stack as soon as a datagram arrives. On the ESP8266
+// that's in the system context, which runs between calls to loop() and
+// whenever loop() yields (yield(), delay()). So it can run in the middle of
+// loop(), but only at those points, which is where loop() has to leave the
+// session state consistent.
+void receiveCallback(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  (void)arg;
+  (void)pcb;
+  uint32_t longPacketBuffer[COMMAND_LENGTH/4];
+  int packetSize = p->tot_len;
+  if (packetSize == COMMAND_LENGTH) {
+    pbuf_copy_partial(p, longPacketBuffer, COMMAND_LENGTH, 0);
+  }
+  pbuf_free(p);
+  inCallback = true;
+  handlePacket(longPacketBuffer, packetSize, IPAddress(ip_addr_get_ip4_u32(addr)), port);
+  inCallback = false;
+}
+
+// Do whatever the receive callback left for us
+void handleEvents() {
+  receiveEvent event;
+  while (popEvent(&event)) {
+    switch (event.type) {
+      case EVENT_REPLY:
+        sendPacket(event.ip, event.port, event.command, event.argument);
+        break;
+      case EVENT_LOG:
+#ifdef DEBUG
+        printPacket(event.message, event.id, event.command, event.argument);
+#endif
+        break;
+      case EVENT_MESSAGE:
+#ifdef DEBUG
+        printMessage(event.message, event.argument, event.ip, event.port);
+#endif
+        break;
+    }
+  }
+#ifdef DEBUG
+  if (logsDropped != logsDroppedShown) {
+    logsDroppedShown = logsDropped;
+    printMessage("Debug messages dropped so far: ", logsDroppedShown, IPAddress(), 0);
+  }
+#endif
+
+  // Flash LED to show recieved, once for however many packets there were
+  unsigned int packets = __atomic_load_n(&packetsForLED, __ATOMIC_ACQUIRE);
+  if (packets != packetsShownOnLED && !stopped) {
+    setLED(!LEDstate);
+  }
+  packetsShownOnLED = packets;
+}
+#endif
+
+
 // the setup function runs once when you press reset or power the board
 void setup() {
   // Setup output pin directions
@@ -224,13 +616,19 @@ void setup() {
   emergencyStop();
 
   // Setup PWM resolution
-  analogWriteRange(MYPWMRANGE);
+  analogWriteRange(MOTOR_PWMRANGE);
 
   // Setup access point
   WiFi.softAP(ssid, password);
 
   // Listen for incoming packets
+#ifdef ASYNC_RECEIVE
+  udpPcb = udp_new();
+  udp_bind(udpPcb, IP_ADDR_ANY, localPort);
+  udp_recv(udpPcb, receiveCallback, NULL);
+#else
   Udp.begin(localPort);
+#endif
 
   // LED HIGH is off, showing no connection
   setLED(HIGH);
@@ -248,75 +646,31 @@ void setup() {
 // the loop function runs over and over again forever
 void loop() {
   // Activate emergency stop if the controller has lost the connection
-  if (millis() - lastPacketTime > CONTROLLER_TIMEOUT) {
+  expireSessions();
+  if (owner == -1) {
     emergencyStop();
   }
 
+#ifndef ASYNC_RECEIVE
   // if there's data available, read a packet
   int packetSize = Udp.parsePacket();
   if (packetSize) {
-#ifdef DEBUG
-    Serial.println("Packet recieved");
-#endif
-    lastPacketTime = millis();
-    // Flash LED to show recieved
-    setLED(!LEDstate);
-
-    // Packet probably is expected, process
-    if (packetSize == PACKET_LENGTH) {
-
-      Udp.read(packetBuffer, UDP_TX_PACKET_MAX_SIZE);
-
-#ifdef DEBUG
-      for (int ii = 0; ii < packetSize; ii++) {
-        Serial.print((unsigned short int)packetBuffer[ii]);
-        Serial.print(" ");
-        if ((ii+1) % 4 == 0)
-          Serial.print(" ");
-      }
-      Serial.print("- ");
-#endif
-
-      // Make so we can maniuplate as unsigned long
-      unsigned long* longPacketBuffer = (unsigned long*)packetBuffer;
-
-      // SDLNet_Write32 uses opposite byte order, so we need to swap it back for the ESP
-      unsigned long packetID = __builtin_bswap32(longPacketBuffer[0]);
-      unsigned long packetCommand = __builtin_bswap32(longPacketBuffer[1]);
-
-      // Emergency stop as early as possible
-      if (packetCommand == 255) {
-        emergencyStop();
-#ifdef DEBUG
-        Serial.println("emergency stop");
-#endif
-      }
-      else {
-        unsigned long packetArg = __builtin_bswap32(longPacketBuffer[2]);
-
-#ifdef DEBUG        
-        Serial.print(packetID);
-        Serial.print(": ");
-        Serial.print(packetCommand);
-        Serial.print(", ");
-        Serial.println(packetArg);
-#endif
-       
-        if (millis() - lastEmergencyStop > EMERGENCY_STOP_TIMEOUT) {
-          // Only process if we have not just emergency stopped
-          processPacket(packetID, packetCommand, packetArg);
-        }
-        if (stopped) {
-           setLED(!LEDstate);
-        }
-      }
-    }
+    Udp.read(packetBuffer, UDP_TX_PACKET_MAX_SIZE);
+    // Make so we can maniuplate as unsigned long
+    handlePacket((uint32_t*)packetBuffer, packetSize, Udp.remoteIP(), Udp.remotePort()); // not unsigned long, that is 64 bits in the host build
   }
+#endif
 
   // a little bit of sleep
   //delayMicroseconds(10);
   yield();
 
+#ifdef ASYNC_RECEIVE
+  // packets have already been acted on in receiveCallback(), which also runs
+  // in the yield() above, this is what it left
+  handleEvents();
+#endif
+
   // check the battery level
   if (millis() - lastBatteryCheck > BATTERY_CHECK_FREQUENCY) {
     setLED(!LEDstate);
@@ -335,7 +689,11 @@ void loop() {
     if (voltage < BATTERY_CUTOFF_VOLTAGE) {
       emergencyStop();
       digitalWrite(LED_BUILTIN, LOW);
+#ifdef ASYNC_RECEIVE
+      udp_remove(udpPcb);
+#else
       Udp.stop();
+#endif
       WiFi.softAPdisconnect(true);
       while (1) {
         delay(1000);
@@ -0,0 +1,54 @@
+/*
+
+  Just enough of the Arduino core for RobotReceiver to build and run on a
+  Linux host, so that it can be tested against without an ESP8266. Pins are
+  remembered rather than driven.
+
+*/
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_ 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <iostream>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+// NodeMCU pin names, as GPIO numbers
+enum {D0 = 16, D1 = 5, D2 = 4, D3 = 0, D4 = 2, D5 = 14, D6 = 12, D7 = 13, D8 = 15, LED_BUILTIN = 2, A0 = 17};
+#define NUM_PINS 18
+
+extern int pinValues[NUM_PINS]; // last digitalWrite()/analogWrite() of each pin
+extern int hostBattery; // what analogRead(A0) returns
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+void analogWriteRange(uint32_t range);
+int analogRead(uint8_t pin);
+
+template<class T, class L, class H> auto constrain(T x, L low, H high) -> decltype(x + low + high) {
+  return x < (T)low ? low : (x > (T)high ? high : x);
+}
+
+// Serial output goes to stdout
+struct HardwareSerial {
+  void begin(unsigned long baud) { (void)baud; }
+  template<class T> void print(const T &value) { std::cout << value; }
+  template<class T> void println(const T &value) { std::cout << value << std::endl; }
+  void println() { std::cout << std::endl; }
+};
+extern HardwareSerial Serial;
+
+#endif /* _HOST_ARDUINO_H_ */
@@ -0,0 +1,24 @@
+#ifndef _HOST_ESP8266WIFI_H_
+#define _HOST_ESP8266WIFI_H_ 1
+
+#include "Arduino.h"
+
+// IPv4 address, kept in network byte order
+struct IPAddress {
+  uint32_t address;
+  IPAddress() : address(0) {}
+  IPAddress(uint32_t address) : address(address) {}
+  bool operator==(const IPAddress &other) const { return address == other.address; }
+  operator uint32_t() const { return address; }
+};
+std::ostream &operator<<(std::ostream &out, const IPAddress &ip);
+
+// There's no access point, the host's own network is used
+struct ESP8266WiFiClass {
+  bool softAP(const char *ssid, const char *password) { (void)ssid; (void)password; return true; }
+  bool softAPdisconnect(bool wifioff) { (void)wifioff; return true; }
+  IPAddress softAPIP() { return IPAddress(); }
+};
+extern ESP8266WiFiClass WiFi;
+
+#endif /* _HOST_ESP8266WIFI_H_ */
@@ -0,0 +1,34 @@
+#ifndef _HOST_WIFIUDP_H_
+#define _HOST_WIFIUDP_H_ 1
+
+#include "ESP8266WiFi.h"
+
+#define UDP_TX_PACKET_MAX_SIZE 8192
+
+// WiFiUDP on a non-blocking POSIX socket, one datagram held at a time like the ESP's
+class WiFiUDP {
+  public:
+    uint8_t begin(uint16_t port);
+    void stop();
+    int parsePacket();
+    int read(char *buffer, size_t len);
+    IPAddress remoteIP() { return rxIP; }
+    uint16_t remotePort() { return rxPort; }
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const char *buffer, size_t size);
+    int endPacket();
+
+  private:
+    int fd = -1;
+    char rxBuffer[UDP_TX_PACKET_MAX_SIZE];
+    int rxLength = 0;
+    int rxAt = 0;
+    IPAddress rxIP;
+    uint16_t rxPort = 0;
+    char txBuffer[UDP_TX_PACKET_MAX_SIZE];
+    size_t txLength = 0;
+    IPAddress txIP;
+    uint16_t txPort = 0;
+};
+
+#endif /* _HOST_WIFIUDP_H_ */
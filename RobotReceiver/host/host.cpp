@@ -0,0 +1,443 @@
+/*
+
+  RobotReceiver host build
+
+  Runs the RobotReceiver sketch as a Linux program on top of the stubs in this
+  folder, listening on the loopback interface (or any other) instead of the
+  ESP's access point. Used for testing the protocol without hardware, e.g.
+  with RobotController's udpstress.
+
+  Usage: robotreceiver [-p port] [-d loop delay us]
+
+  On SIGINT or SIGTERM the number of loops, the longest loop and the number
+  of packets received are printed before exiting. So is the latency from
+  each packet arriving (the kernel's receive timestamp) to the first motor
+  pin it changes, for comparing polling with the ASYNC_RECEIVE callback.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#ifdef ASYNC_RECEIVE
+#include "lwip/udp.h"
+#endif
+
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "WiFiUdp.h"
+
+HardwareSerial Serial;
+ESP8266WiFiClass WiFi;
+int pinValues[NUM_PINS];
+int hostBattery = 300; // about 12.6 V through the sketch's divider
+unsigned long packetsReceived = 0;
+
+#include "../RobotReceiver.ino"
+
+
+// Arrival to pin latency, in us
+#define LATENCY_BUCKETS 100001 // the last one is for anything longer
+static unsigned long latencyCounts[LATENCY_BUCKETS];
+static unsigned long long latencyTotal = 0, latencyMax = 0;
+static unsigned long latencySamples = 0;
+static unsigned long long arrival = 0; // of the packet being acted on, 0 when there isn't one
+
+static unsigned long long realtimens() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now); // the clock the kernel timestamps packets with
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The first motor pin a packet changes ends its latency
+static void pinWritten(uint8_t pin) {
+  if (arrival == 0 || (pin != E_L && pin != E_R && pin != L_F && pin != L_R && pin != R_F && pin != R_R)) {
+    return;
+  }
+  unsigned long long latency = (realtimens() - arrival) / 1000;
+  latencyCounts[latency < LATENCY_BUCKETS ? latency : LATENCY_BUCKETS - 1]++;
+  latencyTotal += latency;
+  if (latency > latencyMax) latencyMax = latency;
+  latencySamples++;
+  arrival = 0;
+}
+
+static unsigned long long latencyPercentile(double fraction) {
+  unsigned long seen = 0;
+  for (int ii = 0; ii < LATENCY_BUCKETS; ii++) {
+    seen += latencyCounts[ii];
+    if (seen > 0 && seen >= fraction * latencySamples) {
+      return ii;
+    }
+  }
+  return 0;
+}
+
+static int enableTimestamps(int fd) {
+  int one = 1;
+  return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+}
+
+// Receive a datagram without waiting, along with when the kernel received it
+static ssize_t receiveDatagram(int fd, char *buffer, size_t length, struct sockaddr_in *addr, unsigned long long *received) {
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+  struct iovec iov = {buffer, length};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = addr;
+  msg.msg_namelen = sizeof(*addr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT);
+  if (n < 0) {
+    return n;
+  }
+  *received = realtimens();
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      struct timespec ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      *received = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+  }
+  packetsReceived++;
+  return n;
+}
+
+
+static struct timespec startTime;
+
+static unsigned long long elapsedus() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - startTime.tv_sec) * 1000000ULL + (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
+
+unsigned long millis() {
+  return (unsigned long)(elapsedus() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)elapsedus();
+}
+
+#ifdef ASYNC_RECEIVE
+static void runNetwork(int wait);
+#endif
+
+void delay(unsigned long ms) {
+#ifdef ASYNC_RECEIVE
+  unsigned long until = millis() + ms;
+  while (millis() < until) {
+    runNetwork(until - millis()); // the ESP8266 runs the network stack while delay()ing
+  }
+#else
+  usleep(ms * 1000);
+#endif
+}
+
+void delayMicroseconds(unsigned int us) {
+  usleep(us);
+}
+
+void yield() {
+#ifdef ASYNC_RECEIVE
+  runNetwork(0);
+#endif
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < NUM_PINS) pinValues[pin] = value;
+  pinWritten(pin);
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < NUM_PINS) pinValues[pin] = value;
+  pinWritten(pin);
+}
+
+void analogWriteRange(uint32_t range) {
+  (void)range;
+}
+
+int analogRead(uint8_t pin) {
+  return pin == A0 ? hostBattery : 0;
+}
+
+std::ostream &operator<<(std::ostream &out, const IPAddress &ip) {
+  struct in_addr addr;
+  addr.s_addr = ip.address;
+  return out << inet_ntoa(addr);
+}
+
+
+#ifndef ASYNC_RECEIVE
+uint8_t WiFiUDP::begin(uint16_t port) {
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return 0;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(fd);
+    fd = -1;
+    return 0;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  enableTimestamps(fd);
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = -1;
+}
+
+// Like the ESP, any of the previous datagram that wasn't read is thrown away.
+// Unlike the ESP, wait up to a millisecond for one to arrive so that an idle
+// receiver doesn't take a whole CPU from whatever is testing it.
+int WiFiUDP::parsePacket() {
+  struct sockaddr_in addr;
+  rxAt = 0;
+  rxLength = fd < 0 ? -1 : receiveDatagram(fd, rxBuffer, sizeof(rxBuffer), &addr, &arrival);
+  if (rxLength < 0 && fd >= 0) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1) > 0) {
+      rxLength = receiveDatagram(fd, rxBuffer, sizeof(rxBuffer), &addr, &arrival);
+    }
+  }
+  if (rxLength <= 0) {
+    rxLength = 0;
+    return 0;
+  }
+  rxIP = IPAddress(addr.sin_addr.s_addr);
+  rxPort = ntohs(addr.sin_port);
+  return rxLength;
+}
+
+int WiFiUDP::read(char *buffer, size_t len) {
+  size_t n = rxLength - rxAt;
+  if (n > len) n = len;
+  memcpy(buffer, rxBuffer + rxAt, n);
+  rxAt += n;
+  return n;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  txIP = ip;
+  txPort = port;
+  txLength = 0;
+  return 1;
+}
+
+size_t WiFiUDP::write(const char *buffer, size_t size) {
+  if (size > sizeof(txBuffer) - txLength) size = sizeof(txBuffer) - txLength;
+  memcpy(txBuffer + txLength, buffer, size);
+  txLength += size;
+  return size;
+}
+
+int WiFiUDP::endPacket() {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = txIP.address;
+  addr.sin_port = htons(txPort);
+  return fd >= 0 && sendto(fd, txBuffer, txLength, 0, (struct sockaddr *)&addr, sizeof(addr)) == (ssize_t)txLength;
+}
+
+#else
+
+// The sketch's one UDP control block, on a POSIX socket
+struct udp_pcb {
+  int fd;
+  udp_recv_fn recv;
+  void *recv_arg;
+};
+static struct udp_pcb hostPcb = {-1, NULL, NULL};
+const ip_addr_t ip_addr_any = {0};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+  (void)layer;
+  (void)type;
+  struct pbuf *p = (struct pbuf *)malloc(sizeof(struct pbuf) + length);
+  if (p == NULL) {
+    return NULL;
+  }
+  p->next = NULL;
+  p->payload = p + 1;
+  p->tot_len = p->len = length;
+  return p;
+}
+
+uint8_t pbuf_free(struct pbuf *p) {
+  free(p);
+  return 1;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+  if (offset >= p->len) {
+    return 0;
+  }
+  if (len > p->len - offset) len = p->len - offset;
+  memcpy(dataptr, (const char *)p->payload + offset, len);
+  return len;
+}
+
+struct udp_pcb *udp_new(void) {
+  hostPcb.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (hostPcb.fd < 0) {
+    perror("socket");
+    return NULL;
+  }
+  return &hostPcb;
+}
+
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ipaddr->addr;
+  addr.sin_port = htons(port);
+  if (bind(pcb->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return ERR_USE;
+  }
+  fcntl(pcb->fd, F_SETFL, fcntl(pcb->fd, F_GETFL) | O_NONBLOCK);
+  enableTimestamps(pcb->fd);
+  return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+  pcb->recv = recv;
+  pcb->recv_arg = recv_arg;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = dst_ip->addr;
+  addr.sin_port = htons(dst_port);
+  return sendto(pcb->fd, p->payload, p->len, 0, (struct sockaddr *)&addr, sizeof(addr)) == p->len ? ERR_OK : ERR_MEM;
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+  if (pcb->fd >= 0) {
+    close(pcb->fd);
+  }
+  pcb->fd = -1;
+}
+
+// What the ESP8266's system context does when the sketch yields or loop()
+// returns, hand every datagram that has arrived to the receive callback.
+// Waits up to wait ms for the first, so an idle receiver doesn't spin.
+static void runNetwork(int wait) {
+  static char buffer[UDP_TX_PACKET_MAX_SIZE];
+  if (hostPcb.fd < 0 || hostPcb.recv == NULL) {
+    return;
+  }
+  if (wait > 0) {
+    struct pollfd pfd = {hostPcb.fd, POLLIN, 0};
+    poll(&pfd, 1, wait);
+  }
+  struct sockaddr_in addr;
+  ssize_t n;
+  while ((n = receiveDatagram(hostPcb.fd, buffer, sizeof(buffer), &addr, &arrival)) >= 0) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM);
+    if (p == NULL) {
+      break;
+    }
+    memcpy(p->payload, buffer, n);
+    ip_addr_t from = {addr.sin_addr.s_addr};
+    hostPcb.recv(hostPcb.recv_arg, &hostPcb, p, &from, ntohs(addr.sin_port)); // frees p
+    arrival = 0;
+  }
+}
+
+#endif
+
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  unsigned int loopDelay = 0;
+  while ((opt = getopt(argc, argv, "p:d:")) != -1) {
+    switch (opt) {
+      case 'p': localPort = atoi(optarg); break;
+      case 'd': loopDelay = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-p port] [-d loop delay us]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  setup();
+  printf("RobotReceiver listening on port %u\n", localPort);
+
+  unsigned long long loops = 0, longest = 0;
+  while (running) {
+    unsigned long long start = elapsedus();
+    loop();
+    arrival = 0; // whatever the loop received has had its chance to change a pin
+    unsigned long long took = elapsedus() - start;
+    if (took > longest) longest = took;
+    loops++;
+    if (loopDelay) {
+      delayMicroseconds(loopDelay); // pretend to be a slower chip
+    }
+#ifdef ASYNC_RECEIVE
+    runNetwork(1);
+#endif
+  }
+
+  printf("%llu loops, longest %llu us, %lu packets received\n", loops, longest, packetsReceived);
+  if (latencySamples > 0) {
+    printf("%s arrival to pin: %lu packets, mean %llu us, median %llu us, 99%% %llu us, max %llu us\n",
+#ifdef ASYNC_RECEIVE
+      "Callback",
+#else
+      "Polling",
+#endif
+      latencySamples, latencyTotal / latencySamples, latencyPercentile(0.5), latencyPercentile(0.99), latencyMax);
+  }
+#ifdef ASYNC_RECEIVE
+  udp_remove(udpPcb);
+#else
+  Udp.stop();
+#endif
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*
+
+  Just enough of lwIP's raw UDP API for RobotReceiver's ASYNC_RECEIVE path to
+  build and run on a Linux host. Received datagrams are handed to the receive
+  callback when the sketch yields or loop() returns, as on the ESP8266.
+
+*/
+
+#ifndef _HOST_LWIP_UDP_H_
+#define _HOST_LWIP_UDP_H_ 1
+
+#include <stdint.h>
+
+typedef uint16_t u16_t;
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_USE -8
+
+// IPv4 only, in network byte order like IPAddress
+typedef struct ip_addr {
+  uint32_t addr;
+} ip_addr_t;
+#define ip_addr_get_ip4_u32(ipaddr) ((ipaddr)->addr)
+#define ip_addr_set_ip4_u32(ipaddr, val) ((ipaddr)->addr = (val))
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
+
+// Always a single buffer here, never a chain
+struct pbuf {
+  struct pbuf *next;
+  void *payload;
+  u16_t tot_len;
+  u16_t len;
+};
+typedef enum {PBUF_TRANSPORT} pbuf_layer;
+typedef enum {PBUF_RAM} pbuf_type;
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+uint8_t pbuf_free(struct pbuf *p);
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb *udp_new(void);
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port);
+void udp_remove(struct udp_pcb *pcb);
+
+#endif /* _HOST_LWIP_UDP_H_ */
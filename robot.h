@@ -4,7 +4,8 @@
 #define _ROBOT_H_ 1
 
 
-// Local PWM range to match what the remote sends
+// PWM range the controller's trims are given in, motor commands are scaled
+// to the receiver's own range once it's been through the capability handshake
 #define MYPWMRANGE 255
 
 // Wifi settings
@@ -18,12 +19,24 @@
 #define CONTROLLER_TIMEOUT 3000 // timeout in milliseconds of last packet recieved
 #define EMERGENCY_STOP_TIMEOUT 1000 // accept no new packets after an emergency stop for X ms
 #define HEARTBEAT_TIMEOUT 500 // send a heart beat every X ms
+#define MIN_CONTROLLER_TIMEOUT 250 // shortest timeout a controller can ask for
 #define PACKET_LENGTH 48 // maximum number of bytes in a packet
+#define PROTOCOL_VERSION 2 // bumped whenever the two sides stop understanding each other
+#define CAPABILITY_RETRY 1000 // ms between capability requests until one is answered
+
+// Capabilities are sent as a key in the top 8 bits of the argument and a value in the rest
+#define CAPABILITY(key, value) ((((unsigned long)(key)) << 24) | ((unsigned long)(value) & 0xFFFFFF))
+#define CAPABILITY_KEY(argument) (((argument) >> 24) & 0xFF)
+#define CAPABILITY_VALUE(argument) ((argument) & 0xFFFFFF)
+typedef enum {CAP_VERSION, CAP_MOTORS, CAP_PWMRANGE, CAP_COMMANDS, CAP_END = 255} capabilityKey;
+// optional commands, as bits of CAP_COMMANDS
+#define OPTIONAL_TIMEOUT (1 << 0) // command 2
+#define OPTIONAL_RESET (1 << 1) // command 254
 
 // Define motors
 #define MAX_NUM_MOTORS 5 // arduino code doesn't use this yet
 typedef enum {LEFT, RIGHT, MOTOR2, MOTOR3, MOTOR4} motor;
-static char *motornames[] = {"left", "right", "motor2", "motor3", "motor4"};
+static const char *const motornames[] = {"left", "right", "motor2", "motor3", "motor4"};
 
 
 #endif /* _ROBOT_H_ */